@@ -0,0 +1,71 @@
+#ifndef ALBUM_ART_H
+#define ALBUM_ART_H
+
+// directly used
+#include <mpd/client.h>
+#include <mpd/albumart.h>
+#include <mpd/binary.h>
+#include <mpd/readpicture.h>
+#include <stdbool.h>
+#include <stddef.h>
+// indirectly used
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// readpicture chunk size (mpd's default binarylimit)
+#define ART_CHUNK_SIZE 8192
+// what we ask for with binarylimit, a typical embedded cover fits in one or two chunks
+#define ART_BINARY_LIMIT (512 * 1024)
+
+// growable in-memory copy of the picture bytes
+typedef struct
+{
+    unsigned char *data;
+    size_t size;
+    size_t capacity;
+} ArtBuffer;
+
+// one picture transfer: chunk size going in, what it cost coming out
+typedef struct
+{
+    size_t chunk_size;    // bytes per response, 0 means ART_CHUNK_SIZE
+    size_t bytes;         // picture bytes received
+    unsigned round_trips; // readpicture/albumart commands sent
+    bool from_folder;     // came from albumart (cover file) rather than the song's tags
+    bool local;           // read from the music directory on this machine, no mpd involved
+} ArtTransfer;
+
+// a cover file mapped straight from disk
+typedef struct
+{
+    const unsigned char *data;
+    size_t size;
+} ArtMapping;
+
+// start empty
+void art_buffer_init(ArtBuffer *buffer);
+// make room for size more bytes, doubling the buffer as needed
+bool art_buffer_reserve(ArtBuffer *buffer, size_t size);
+// append bytes, doubling the buffer as needed
+bool art_buffer_append(ArtBuffer *buffer, const void *data, size_t size);
+// release the bytes
+void art_buffer_free(ArtBuffer *buffer);
+
+// asked between chunks, returning false abandons the transfer
+typedef bool (*ArtContinueFn)(void *arg);
+
+// raise the connection's binarylimit to ART_BINARY_LIMIT, returns the chunk size to use
+size_t art_negotiate_chunk_size(struct mpd_connection *conn);
+// read the embedded picture of uri into buffer, falling back to the cover file in its directory;
+// 0 on success, -1 on failure or when cancelled. transfer may be NULL
+int fetch_song_art(struct mpd_connection *conn, const char *uri, ArtBuffer *buffer, ArtTransfer *transfer,
+                   ArtContinueFn keep_going, void *arg);
+// mpd's music_directory if we're on its machine (local socket only), caller frees, NULL otherwise
+char *art_query_music_root(struct mpd_connection *conn);
+// mmap cover.jpg, folder.jpg, ... from uri's directory under music_root, false if there is none
+bool art_map_local_cover(const char *music_root, const char *uri, ArtMapping *mapping);
+// unmap a cover mapped by art_map_local_cover
+void art_unmap_cover(ArtMapping *mapping);
+
+#endif
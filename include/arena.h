@@ -0,0 +1,33 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+// default block size, big enough that a listing needs a handful of blocks
+#define ARENA_BLOCK_SIZE (64 * 1024)
+
+typedef struct ArenaBlock
+{
+    struct ArenaBlock *next;
+    size_t used;
+    size_t size;
+    char data[];
+} ArenaBlock;
+
+// bump-pointer allocator, everything in it is released at once by arena_free()
+typedef struct
+{
+    ArenaBlock *head; // block currently being filled
+    size_t block_size;
+} Arena;
+
+// set up an empty arena (no allocation until the first arena_alloc)
+void arena_init(Arena *arena, size_t block_size);
+// get size bytes aligned to a pointer, NULL if out of memory
+void *arena_alloc(Arena *arena, size_t size);
+// copy a string into the arena
+char *arena_strdup(Arena *arena, const char *str);
+// release every block
+void arena_free(Arena *arena);
+
+#endif
@@ -0,0 +1,60 @@
+#ifndef ART_CACHE_H
+#define ART_CACHE_H
+
+// directly used
+#include <stdbool.h>
+#include <stddef.h>
+#include "../include/ascii_art.h"
+// indirectly used
+#include <stdlib.h>
+#include <string.h>
+
+#define ART_CACHE_BUCKETS 64
+
+// a rendered cover plus its lru order (prev is more recent) and hash bucket chain.
+// art is NULL when the album has no usable picture, so we don't ask again.
+typedef struct ArtCacheEntry
+{
+    char *album; // directory part of the song uri, tracks of one album share it
+    int width;
+    int height;
+    ArtMode mode;
+    AsciiArt *art;
+    size_t bytes; // what this entry counts against the budget
+    struct ArtCacheEntry *prev;
+    struct ArtCacheEntry *next;
+    struct ArtCacheEntry *chain;
+} ArtCacheEntry;
+
+typedef struct
+{
+    ArtCacheEntry *buckets[ART_CACHE_BUCKETS];
+    ArtCacheEntry *head; // most recently used
+    ArtCacheEntry *tail; // least recently used
+    size_t bytes;
+    size_t budget; // evict past this many bytes
+    ArtCacheEntry *pinned; // never evicted, the cover on screen
+
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long evictions;
+} ArtCache;
+
+// start with an empty cache holding at most budget bytes of art
+void art_cache_init(ArtCache *cache, size_t budget);
+// drop every entry (counters are kept)
+void art_cache_clear(ArtCache *cache);
+// the album key of a song uri, caller frees
+char *art_cache_album(const char *uri);
+// look up and count a hit or miss; on a hit *art is the cached art (may be NULL for "no art")
+bool art_cache_lookup(ArtCache *cache, const char *album, int width, int height, ArtMode mode, const AsciiArt **art);
+// same without touching lru order or counters, used when redrawing
+const AsciiArt *art_cache_peek(const ArtCache *cache, const char *album, int width, int height, ArtMode mode);
+// true if the key is cached, without touching lru order or counters
+bool art_cache_contains(const ArtCache *cache, const char *album, int width, int height, ArtMode mode);
+// keep the entry for this key (if cached) from being evicted, replacing the previous pin
+void art_cache_pin(ArtCache *cache, const char *album, int width, int height, ArtMode mode);
+// store art (taking ownership, NULL allowed), replacing an older entry for the same key
+void art_cache_insert(ArtCache *cache, const char *album, int width, int height, ArtMode mode, AsciiArt *art);
+
+#endif
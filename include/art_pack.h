@@ -0,0 +1,86 @@
+#ifndef ART_PACK_H
+#define ART_PACK_H
+
+// directly used
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#include "../include/ascii_art.h"
+// indirectly used
+#include <stdlib.h>
+#include <string.h>
+
+#define ART_PACK_MAGIC "ORPHPAK1"
+#define ART_PACK_VERSION 2
+#define ART_PACK_RECORD_MAGIC 0x41524543u // "CERA"
+#define ART_PACK_BUCKETS 256
+#define DEFAULT_ART_PACK_LIMIT (16 * 1024) // KiB
+
+// start of the file
+typedef struct
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+} ArtPackHeader;
+
+// start of every record, followed by the album path (no NUL), then num_lines
+// NUL terminated lines, padded to 8 bytes
+typedef struct
+{
+    uint32_t magic;
+    uint32_t length;   // whole record, header and padding included
+    int64_t mtime;     // song mtime the art was fetched for
+    uint32_t checksum; // FNV-1a of this header (checksum taken as 0) and everything after it
+    uint16_t album_len;
+    uint16_t width;
+    uint16_t height;
+    uint16_t num_lines; // 0 when the album has no usable picture
+    uint16_t max_width;
+    uint8_t mode;
+    uint8_t reserved;
+} ArtPackRecord;
+
+// where the newest record for one key lives
+typedef struct ArtPackSlot
+{
+    uint64_t offset;
+    uint32_t length;
+    uint32_t hash;
+    struct ArtPackSlot *chain;
+} ArtPackSlot;
+
+// Rendered covers on disk so a restart doesn't fetch them again.
+// Records are only ever appended, a newer record for a key shadows the older one,
+// and the file is rewritten with only the live records once it outgrows its limit.
+// The art worker stores, the ui looks up; lock guards everything below it.
+typedef struct
+{
+    pthread_mutex_t lock;
+    char *path;
+    int fd; // -1 while the pack is unusable, every call is then a no-op
+    unsigned char *map; // remapped on the next lookup or store after the file grew
+    size_t map_size;
+    size_t file_size;
+    size_t live_bytes; // records still reachable from the index
+    size_t limit;
+    ArtPackSlot *buckets[ART_PACK_BUCKETS];
+} ArtPack;
+
+// $XDG_CACHE_HOME/orpheus/art.pack (or ~/.cache/...), creating the directory; caller frees
+char *art_pack_default_path(void);
+// open or create the pack and index it, false leaves it closed (fd -1)
+bool art_pack_open(ArtPack *pack, const char *path, size_t limit);
+// find art rendered for album at this size and mode no older than song_mtime;
+// on true *art is a fresh copy (NULL when the album has no picture) the caller owns
+bool art_pack_lookup(ArtPack *pack, const char *album, int width, int height, ArtMode mode, time_t song_mtime, AsciiArt **art);
+// art_pack_lookup, but a miss instead of waiting while another thread is writing the pack
+bool art_pack_try_lookup(ArtPack *pack, const char *album, int width, int height, ArtMode mode, time_t song_mtime, AsciiArt **art);
+// append art (NULL allowed) for album, compacting first if the pack would outgrow its limit
+void art_pack_store(ArtPack *pack, const char *album, int width, int height, ArtMode mode, time_t song_mtime, const AsciiArt *art);
+// unmap and close
+void art_pack_close(ArtPack *pack);
+
+#endif
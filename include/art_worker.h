@@ -0,0 +1,83 @@
+#ifndef ART_WORKER_H
+#define ART_WORKER_H
+
+// directly used
+#include <mpd/client.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <time.h>
+#include "../include/ascii_art.h"
+#include "../include/album_art.h"
+#include "../include/art_pack.h"
+#include "../include/lua_config.h"
+// indirectly used
+#include <stdlib.h>
+#include <string.h>
+
+// what to fetch and how to render it
+typedef struct
+{
+    char *uri;
+    time_t mtime; // song's last modification, passed through for the art pack
+    int width;
+    int height;
+    ArtMode mode;
+} ArtRequest;
+
+// a finished conversion handed from the worker to the ui thread
+typedef struct ArtResult
+{
+    ArtRequest request;   // what this answers, the ui keys its caches on it
+    AsciiArt *art;        // NULL when the song has no usable picture
+    bool failed;          // mpd couldn't be reached, a NULL art means nothing about the song
+    bool from_pack;       // found in the pack after all, nothing was fetched
+    bool prefetch;        // fetched ahead for the next song in the queue
+    ArtTransfer transfer; // what fetching the picture took
+    struct ArtResult *next;
+} ArtResult;
+
+// Fetches and decodes album art on its own thread and mpd connection.
+// The ui posts the cover it needs now and, at lower priority, the next song's cover.
+// The worker pushes results onto a lock-free stack and pokes event_fd so the ui's poll() wakes up.
+// Fresh covers are written to the pack here too, the ui thread never waits on the disk for them.
+typedef struct
+{
+    pthread_t thread;
+    const Config *config;
+    ArtPack *pack;               // shared with the ui, which only looks things up
+    struct mpd_connection *conn; // only touched by the worker thread
+    size_t chunk_size;           // binarylimit negotiated on conn
+    char *music_root;            // where covers can be read directly, NULL when mpd is remote
+    bool asked_music_root;       // only ask mpd once
+
+    // queued requests and the one being worked on, guarded by lock
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    ArtRequest current;
+    ArtRequest prefetch;
+    ArtRequest active; // uri is NULL while idle, borrowed from the job otherwise
+    bool active_prefetch;
+    bool pending;
+    bool prefetch_pending;
+    bool quit;
+
+    atomic_uint generation;       // bumped per current request, whatever is in flight gets abandoned
+    _Atomic(ArtResult *) results; // finished results not yet taken, newest first
+    int event_fd;                 // readable while results has something
+} ArtWorker;
+
+// spawn the worker, config and pack (which may be closed) must outlive it
+bool art_worker_start(ArtWorker *worker, const Config *config, ArtPack *pack);
+// ask for uri's art now, replacing the previous request unless it is already being worked on
+void art_worker_request(ArtWorker *worker, const char *uri, time_t mtime, int width, int height, ArtMode mode);
+// ask for uri's art once nothing more urgent is queued, replacing the previous prefetch
+void art_worker_prefetch(ArtWorker *worker, const char *uri, time_t mtime, int width, int height, ArtMode mode);
+// take every finished result (ui thread) oldest first, linked through next; NULL if there is none
+ArtResult *art_worker_take(ArtWorker *worker);
+// free one taken result (not the ones linked after it)
+void art_result_free(ArtResult *result);
+// stop and join the worker
+void art_worker_stop(ArtWorker *worker);
+
+#endif
@@ -1,6 +1,14 @@
 #ifndef ASCII_ART_H
 #define ASCII_ART_H
 
+#include <stddef.h>
+
+/* How luminance maps onto glyphs */
+typedef enum {
+    ART_MODE_ASCII = 0,    /* dark pixels are dense glyphs (light terminal text on dark) */
+    ART_MODE_INVERTED = 1  /* dark pixels are sparse glyphs (dark text on light) */
+} ArtMode;
+
 /* Structure to hold ASCII art output */
 typedef struct {
     char **lines;    /* Array of strings (ASCII art lines) */
@@ -9,14 +17,16 @@ typedef struct {
 } AsciiArt;
 
 /*
- * Convert a JPEG image to ASCII art.
- * @param image_path: Path to the JPEG file.
+ * Convert an in-memory JPEG image to ASCII art.
+ * @param data: JPEG bytes.
+ * @param size: Number of bytes in data.
  * @param ascii_width: Desired width of ASCII art in characters.
  * @param max_height: Maximum height of ASCII art in lines.
+ * @param mode: Glyph ramp to use.
  * @return: AsciiArt structure with the result, or NULL on error.
  * Caller must free the result using ascii_art_free().
  */
-AsciiArt *jpeg_to_ascii(const char *image_path, int ascii_width, int max_height);
+AsciiArt *jpeg_to_ascii(const unsigned char *data, size_t size, int ascii_width, int max_height, ArtMode mode);
 
 /*
  * Free an AsciiArt structure and its contents.
@@ -0,0 +1,92 @@
+#ifndef CMD_WORKER_H
+#define CMD_WORKER_H
+
+// directly used
+#include <mpd/client.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include "../include/lua_config.h"
+// indirectly used
+#include <stdlib.h>
+#include <string.h>
+
+// commands (and results) that may be waiting at once
+#define COMMAND_QUEUE_SIZE 32
+// adds sent per command list, keeps each list well under mpd's max_command_list_size
+#define ADD_BATCH_SIZE 512
+
+typedef enum
+{
+    CMD_PLAY,
+    CMD_PAUSE,
+    CMD_NEXT,
+    CMD_PREVIOUS,
+    CMD_PLAY_POS, // play the song at a queue position
+    CMD_ADD, // append uris (directories recursively) to the queue
+} CommandOp;
+
+// a queued command, uris only for CMD_ADD
+typedef struct
+{
+    CommandOp op;
+    unsigned position; // CMD_PLAY_POS only
+    char **uris; // owned by the queue, freed once run
+    int count;
+} Command;
+
+// how a queued command went; a CMD_ADD posts one per batch with done growing to total
+typedef struct
+{
+    CommandOp op;
+    bool ok;
+    bool final;     // last result for this command
+    int done;       // uris added so far
+    int total;
+    char error[96]; // mpd's message when !ok
+} CommandResult;
+
+// Runs playback and queue commands on its own thread and mpd connection so a key press never
+// waits for the network. Commands run in the order they were sent; every one
+// produces a result, and event_fd turns readable while results are waiting.
+// An add's progress the ui hasn't taken yet is replaced by newer progress or its final result,
+// so every outstanding command holds at most one result slot and no final result is ever lost.
+typedef struct
+{
+    pthread_t thread;
+    const Config *config;
+    struct mpd_connection *conn; // only touched by the worker thread
+
+    // both rings guarded by lock
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    Command queue[COMMAND_QUEUE_SIZE];
+    int queue_head;
+    int queue_count;
+    CommandResult results[COMMAND_QUEUE_SIZE];
+    int results_head;
+    int results_count;
+    int outstanding; // commands queued, running or with their final result not taken yet, at most COMMAND_QUEUE_SIZE
+    bool quit;
+
+    int event_fd;
+} CommandWorker;
+
+// run one playback command on conn (position only for CMD_PLAY_POS), filling error on failure
+// (also used when there's no worker)
+bool command_run(struct mpd_connection *conn, CommandOp op, unsigned position, char *error, size_t error_size);
+// add uris[0..count) as command lists of ADD_BATCH_SIZE, progress (may be NULL) is told after each;
+// returns how many were added before the first failure
+int command_run_add(struct mpd_connection *conn, char *const *uris, int count, char *error, size_t error_size,
+                    void (*progress)(void *arg, int done, int total), void *arg);
+// spawn the worker, config must outlive it
+bool cmd_worker_start(CommandWorker *worker, const Config *config);
+// queue a playback command, false if COMMAND_QUEUE_SIZE commands are already outstanding
+bool cmd_worker_send(CommandWorker *worker, CommandOp op, unsigned position);
+// queue adding uris, taking ownership of them (also when the queue is full and this returns false)
+bool cmd_worker_send_add(CommandWorker *worker, char **uris, int count);
+// copy up to max finished results into out (ui thread), returns how many
+int cmd_worker_take(CommandWorker *worker, CommandResult *out, int max);
+// stop and join the worker, dropping queued commands
+void cmd_worker_stop(CommandWorker *worker);
+
+#endif
@@ -0,0 +1,54 @@
+#ifndef DIR_CACHE_H
+#define DIR_CACHE_H
+
+// directly used
+#include <mpd/client.h>
+#include <stdbool.h>
+#include <time.h>
+#include "../include/dir_listing.h"
+#include "../include/listing_worker.h"
+// indirectly used
+#include <stdlib.h>
+#include <string.h>
+
+// how many directory listings we keep around before evicting the oldest
+#define DIR_CACHE_CAPACITY 64
+#define DIR_CACHE_BUCKETS 128
+
+// a cached listing plus its lru order (prev is more recent) and hash bucket chain
+typedef struct DirCacheEntry
+{
+    DirListing listing;
+    struct DirCacheEntry *prev;
+    struct DirCacheEntry *next;
+    struct DirCacheEntry *chain;
+} DirCacheEntry;
+
+typedef struct
+{
+    DirCacheEntry *buckets[DIR_CACHE_BUCKETS];
+    DirCacheEntry *head; // most recently used
+    DirCacheEntry *tail; // least recently used
+    int count;
+    unsigned long db_update; // mpd db_update time the listings belong to
+    const Library *library; // listings are built from it while it's loaded, lsinfo otherwise
+    ListingWorker *worker; // streams the lsinfo listings, NULL to fetch them inline
+    DirCacheEntry *streaming; // entry the worker is filling in
+    char *failed; // path whose listing just failed, not asked for again until another path was
+    char error[96]; // why it failed
+} DirCache;
+
+// start with an empty cache
+void dir_cache_init(DirCache *cache);
+// drop every listing
+void dir_cache_clear(DirCache *cache);
+// get the listing for path, only asking mpd on a miss the library can't answer (NULL on mpd error).
+// With a worker that listing comes back empty and streaming, and a listing still streaming
+// for another path is abandoned
+const DirListing *dir_cache_get(DirCache *cache, struct mpd_connection *conn, const char *path);
+// move what the worker streamed into its listing, sorting it once done; a failed one is dropped
+ListingState dir_cache_receive(DirCache *cache);
+// check mpd's db_update time and clear the cache if it moved, returns true if cleared
+bool dir_cache_sync_db_update(DirCache *cache, struct mpd_connection *conn);
+
+#endif
@@ -0,0 +1,48 @@
+#ifndef DIR_LISTING_H
+#define DIR_LISTING_H
+
+// directly used
+#include <mpd/client.h>
+#include <stdbool.h>
+#include "../include/arena.h"
+#include "../include/library.h"
+// indirectly used
+#include <stdlib.h>
+#include <string.h>
+
+typedef enum
+{
+    ENTRY_DIRECTORY = 0,
+    ENTRY_SONG = 1
+} EntryType;
+
+// one lsinfo result as a struct of arrays, every string lives in the listing's arena
+typedef struct
+{
+    char *path;
+    const char **uris;
+    unsigned char *types; // EntryType
+    int count;
+    int capacity;
+    bool streaming; // still arriving from the listing worker, in mpd's order until it's sorted at the end
+    Arena strings;
+} DirListing;
+
+// set up an empty listing for path
+bool dir_listing_init(DirListing *listing, const char *path);
+// append an entry, copying uri into the arena
+bool dir_listing_push(DirListing *listing, const char *uri, EntryType type);
+// send lsinfo for listing->path and append every directory and song
+bool dir_listing_fetch(DirListing *listing, struct mpd_connection *conn);
+// fill from the in-memory library instead, false if path isn't a directory in it
+bool dir_listing_from_library(DirListing *listing, const Library *library);
+// order directories before songs, each group by case-insensitive name
+void dir_listing_sort(DirListing *listing);
+// binary search for the first entry whose name starts with letter (-1 if none)
+int dir_listing_find_letter(const DirListing *listing, char letter);
+// the part of a uri after the last '/'
+const char *dir_listing_name(const char *uri);
+// release the arrays and the arena in one go
+void dir_listing_free(DirListing *listing);
+
+#endif
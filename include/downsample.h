@@ -0,0 +1,34 @@
+#ifndef DOWNSAMPLE_H
+#define DOWNSAMPLE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Box filter that turns a stream of 8-bit grayscale rows into the mean
+// luminance of each character cell. Rows are pushed one at a time so the
+// source image never has to be held in memory.
+typedef struct
+{
+    int src_width;
+    int src_height;
+    int cells_x;
+    int cells_y;
+    int *col_start;    // first source column of each cell column (cells_x + 1 entries)
+    int *col_end;      // one past the last source column of each cell column
+    uint32_t *row_sum; // per source column, sum over the rows of the current cell row
+    int rows_summed;   // rows added to row_sum so far
+    int next_row;      // source row expected next
+    int cell_row;      // cell row being accumulated
+    unsigned char *means; // cells_x * cells_y results
+    // row accumulator picked for this cpu (avx2, sse2, neon or scalar)
+    void (*accumulate)(uint32_t *sum, const unsigned char *row, int width);
+} Downsampler;
+
+// set up for a src_width x src_height image going into a cells_x x cells_y grid
+bool downsampler_init(Downsampler *ds, int src_width, int src_height, int cells_x, int cells_y);
+// add the next source row (src_width bytes)
+void downsampler_push_row(Downsampler *ds, const unsigned char *row);
+// release the buffers (means included)
+void downsampler_free(Downsampler *ds);
+
+#endif
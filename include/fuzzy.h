@@ -0,0 +1,73 @@
+#ifndef FUZZY_H
+#define FUZZY_H
+
+// directly used
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "../include/library.h"
+// indirectly used
+#include <stdlib.h>
+#include <string.h>
+
+#define FUZZY_MAX_RESULTS 200
+#define FUZZY_MAX_THREADS 8
+#define FUZZY_QUERY_MAX 128
+// candidates a worker takes at a time, results are published after each block
+#define FUZZY_BLOCK 4096
+
+// one scored candidate
+typedef struct
+{
+    uint32_t candidate;
+    int score;
+} FuzzyMatch;
+
+// fzf style "jump to" over every directory and song path of the library.
+// Candidates are directories (the root left out) followed by songs. Each one has a bit mask
+// of the characters it contains; a vectorized pass over the masks throws out everything that
+// can't hold the query before the subsequence check and scoring run on what's left.
+// Blocks of candidates are handed to worker threads, each block's best matches are merged
+// into the shared results and event_fd is poked, so results stream in while the scan runs.
+// A new query bumps the generation and blocks of the old one are dropped.
+typedef struct
+{
+    const Library *library;
+    uint64_t *masks;      // built by the first query after the library changed (ui thread)
+    uint32_t candidate_count;
+    pthread_t threads[FUZZY_MAX_THREADS];
+    int thread_count;
+
+    // guarded by lock
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    pthread_cond_t idle;
+    char query[FUZZY_QUERY_MAX]; // lowercased
+    uint64_t query_mask;
+    unsigned job;         // generation of the query being answered
+    uint32_t next_block;  // first candidate not handed out yet
+    uint32_t scanned;     // candidates done for job
+    int busy;             // workers inside a block
+    FuzzyMatch best[FUZZY_MAX_RESULTS]; // best first
+    int best_count;
+    bool quit;
+
+    atomic_uint generation; // == job while it's current, read by workers between candidates
+    int event_fd;
+} FuzzyFinder;
+
+// spawn the workers, library must outlive the finder
+bool fuzzy_finder_start(FuzzyFinder *finder, const Library *library);
+// answer query from now on, abandoning the previous one (ui thread)
+void fuzzy_finder_query(FuzzyFinder *finder, const char *query);
+// copy the best results so far, *scanned says how far the scan got (of candidate_count)
+int fuzzy_finder_results(FuzzyFinder *finder, FuzzyMatch *out, int max, uint32_t *scanned);
+// path of a candidate, *is_dir set for directories
+const char *fuzzy_candidate(const FuzzyFinder *finder, uint32_t candidate, bool *is_dir);
+// cancel, wait for the workers to let go and forget the masks; before the library is replaced
+void fuzzy_finder_reset(FuzzyFinder *finder);
+// stop and join the workers
+void fuzzy_finder_stop(FuzzyFinder *finder);
+
+#endif
@@ -0,0 +1,72 @@
+#ifndef LIBRARY_H
+#define LIBRARY_H
+
+// directly used
+#include <mpd/client.h>
+#include <stdbool.h>
+#include <stdint.h>
+// indirectly used
+#include <stdlib.h>
+#include <string.h>
+
+#define LIBRARY_ROOT 0 // directory index of the music root ("")
+#define LIBRARY_NONE UINT32_MAX // parent of the root, missing lookups
+
+// offset of a NUL terminated string in the library's string pool, 0 is ""
+typedef uint32_t LibStr;
+
+// The whole database from one listallinfo, kept in flat arrays.
+// Strings live in a single pool and are referred to by offset, tag values are interned
+// so every artist/album/... is stored once. Directories are ordered so the children of
+// each one are contiguous, songs so each directory's songs are, both sorted like lsinfo
+// listings, which makes a directory listing a pair of slices.
+typedef struct
+{
+    char *strings; // string pool, starts with ""
+    uint32_t strings_size;
+    uint32_t strings_capacity;
+    uint32_t *intern; // open addressing set of pool offsets (0 for an empty slot)
+    uint32_t intern_size; // power of two
+    uint32_t intern_count;
+
+    // songs, struct of arrays
+    LibStr *song_uri;
+    LibStr *song_title;
+    LibStr *song_artist;
+    LibStr *song_album;
+    LibStr *song_date;
+    uint32_t *song_duration; // seconds
+    uint32_t *song_dir;
+    uint32_t song_count;
+    uint32_t song_capacity;
+
+    // directories, index 0 is the root
+    LibStr *dir_path;
+    uint32_t *dir_parent;
+    uint32_t *dir_first_child;
+    uint32_t *dir_child_count;
+    uint32_t *dir_first_song;
+    uint32_t *dir_song_count;
+    uint32_t dir_count;
+    uint32_t dir_capacity;
+    uint32_t *dir_table; // open addressing path -> index + 1 (0 for an empty slot)
+    uint32_t dir_table_size;
+
+    unsigned long db_update; // mpd db_update time the index was loaded at
+    bool loaded;
+    void *map; // snapshot the arrays point into (read only), NULL when built from mpd
+    size_t map_size;
+} Library;
+
+// start empty (not loaded)
+void library_init(Library *library);
+// stream listallinfo into a fresh index and swap it in, the old one is kept on failure
+bool library_load(Library *library, struct mpd_connection *conn, unsigned long db_update);
+// string at offset
+const char *library_str(const Library *library, LibStr str);
+// directory index for path ("" is the root), LIBRARY_NONE if it isn't one
+uint32_t library_find_dir(const Library *library, const char *path);
+// release everything (or unmap the snapshot), back to not loaded
+void library_free(Library *library);
+
+#endif
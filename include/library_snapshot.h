@@ -0,0 +1,46 @@
+#ifndef LIBRARY_SNAPSHOT_H
+#define LIBRARY_SNAPSHOT_H
+
+// directly used
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "../include/library.h"
+#include "../include/lua_config.h"
+// indirectly used
+#include <stdlib.h>
+#include <string.h>
+
+#define LIBRARY_SNAPSHOT_MAGIC "ORPHLIB1"
+#define LIBRARY_SNAPSHOT_VERSION 1
+#define LIBRARY_SNAPSHOT_SERVER_MAX 256
+// the string pool plus every uint32_t array of Library, in the order of its fields
+#define LIBRARY_SNAPSHOT_SECTIONS 15
+
+// start of the file, the sections follow at 8 byte aligned offsets
+typedef struct
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t header_size; // sizeof(LibrarySnapshotHeader), catches layout changes
+    char server[LIBRARY_SNAPSHOT_SERVER_MAX]; // address the index came from, NUL terminated
+    uint64_t db_update; // mpd db_update time the index was loaded at
+    uint64_t file_size;
+    uint32_t strings_size;
+    uint32_t song_count;
+    uint32_t dir_count;
+    uint32_t dir_table_size;
+    uint64_t sections[LIBRARY_SNAPSHOT_SECTIONS]; // file offset of each section
+} LibrarySnapshotHeader;
+
+// "host:port" or the socket path, what snapshots are keyed on
+void library_snapshot_server(const Config *config, char *server, size_t size);
+// $XDG_CACHE_HOME/orpheus/library-<hash of server>.snap (or ~/.cache/...), creating the directory; caller frees
+char *library_snapshot_path(const char *server);
+// map the snapshot at path if it's intact and from server, the library then points straight into
+// the mapping; its db_update tells whether it's still current
+bool library_snapshot_open(Library *library, const char *path, const char *server);
+// write library to path through a temporary file, so a crash never leaves half a snapshot behind
+bool library_snapshot_save(const Library *library, const char *path, const char *server);
+
+#endif
@@ -0,0 +1,49 @@
+#ifndef LIBRARY_WORKER_H
+#define LIBRARY_WORKER_H
+
+// directly used
+#include <mpd/client.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include "../include/library.h"
+#include "../include/library_snapshot.h"
+#include "../include/lua_config.h"
+// indirectly used
+#include <stdlib.h>
+#include <string.h>
+
+// Loads the library index on its own thread and mpd connection, then writes the snapshot
+// the next start maps instead. The ui keeps browsing the index it has (or asking mpd) meanwhile;
+// event_fd turns readable once a fresh index is ready to take.
+typedef struct
+{
+    pthread_t thread;
+    const Config *config;
+    char server[LIBRARY_SNAPSHOT_SERVER_MAX];
+    char *snapshot_path; // NULL when there is no cache directory, the index then isn't saved
+
+    // guarded by lock
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    struct mpd_connection *conn; // connection of the load in progress, shut down by stop to cut it short
+    unsigned long db_update; // what the next load is for
+    bool pending;
+    bool quit;
+    Library result;
+    bool ready; // result holds a fresh index
+
+    int event_fd;
+} LibraryWorker;
+
+// spawn the worker, config must outlive it
+bool library_worker_start(LibraryWorker *worker, const Config *config);
+// map the snapshot of the last run for our server, if there is one (ui thread, before run_tui)
+bool library_worker_open_snapshot(LibraryWorker *worker, Library *library);
+// (re)load the index for db_update, replacing a request that didn't start yet
+void library_worker_request(LibraryWorker *worker, unsigned long db_update);
+// swap the freshly loaded index into library, false if none is ready
+bool library_worker_take(LibraryWorker *worker, Library *library);
+// cut a load in progress short and join the worker
+void library_worker_stop(LibraryWorker *worker);
+
+#endif
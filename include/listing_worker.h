@@ -0,0 +1,67 @@
+#ifndef LISTING_WORKER_H
+#define LISTING_WORKER_H
+
+// directly used
+#include <mpd/client.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include "../include/dir_listing.h"
+#include "../include/lua_config.h"
+// indirectly used
+#include <stdlib.h>
+#include <string.h>
+
+// entries streamed before the ui is first woken up, about a screenful
+#define LISTING_FIRST_BATCH 64
+// later wake ups come after twice as many entries each time, up to this many
+#define LISTING_MAX_BATCH 4096
+
+typedef enum
+{
+    LISTING_STREAMING,
+    LISTING_DONE,
+    LISTING_FAILED
+} ListingState;
+
+// Streams one lsinfo at a time on its own thread and mpd connection, so a huge folder
+// never holds up the ui. Entries pile up until the ui takes them, event_fd turns readable
+// after the first screenful, then after batches that double in size, and once the listing ends.
+// A new request or a cancel abandons the listing in progress by shutting its socket down.
+typedef struct
+{
+    pthread_t thread;
+    const Config *config;
+    struct mpd_connection *conn; // only touched by the worker thread, except for the shutdown
+
+    // guarded by lock
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    char *path;          // directory asked for, NULL if none
+    unsigned request;    // bumped by every request and cancel, a stream of an older one stops
+    bool pending;        // path wasn't picked up yet
+    bool streaming;      // conn is inside an lsinfo
+    bool broken;         // conn was shut down under a stream, reconnect next time
+    char **uris;         // streamed in and not taken yet
+    unsigned char *types;
+    int count;
+    int capacity;
+    ListingState state;
+    char error[96];      // mpd's message when LISTING_FAILED
+    bool quit;
+
+    int event_fd;
+} ListingWorker;
+
+// spawn the worker, config must outlive it
+bool listing_worker_start(ListingWorker *worker, const Config *config);
+// start streaming path, abandoning whatever is in progress
+void listing_worker_request(ListingWorker *worker, const char *path);
+// abandon the listing in progress and drop what it streamed
+void listing_worker_cancel(ListingWorker *worker);
+// append what streamed in since the last take to listing (ui thread), error is set on LISTING_FAILED;
+// a NULL listing just drops it, for wake ups left over from an abandoned listing
+ListingState listing_worker_take(ListingWorker *worker, DirListing *listing, char *error, size_t error_size);
+// stop and join the worker
+void listing_worker_stop(ListingWorker *worker);
+
+#endif
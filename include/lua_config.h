@@ -7,7 +7,27 @@
 #include <string.h>
 #include <lauxlib.h>
 
+// everything config.lua can set, strings are heap allocated (NULL if unset)
+typedef struct
+{
+    char *starting_directory;
+    char *connection_type;
+    char *socket_path;
+    char *host;
+    int port;
+    char *music_root;     // mpd's music_directory on this machine, NULL to ask mpd (socket only)
+    int art_cache_budget; // KiB of rendered album art kept in memory
+    int art_mode;         // ArtMode, "ascii" or "inverted"
+    int art_pack_limit;   // KiB the on-disk art pack may grow to, 0 turns it off
+    char *visualizer_fifo; // mpd fifo output the footer spectrum reads, NULL for none
+    int visualizer_rate;  // sample rate of that fifo, its format has to be rate:16:2
+} Config;
+
+#define DEFAULT_ART_CACHE_BUDGET 1024
+
 // setup and configure lua script (required for tui to work)
-void config_lua(lua_State *L, char *starting_directory, char *connection_type, char *socket_path, char *host, int *port);
+void config_lua(lua_State *L, Config *config);
+// free the config strings
+void config_free(Config *config);
 
 #endif
\ No newline at end of file
@@ -3,14 +3,63 @@
 
 // directly used
 #include <mpd/client.h>
-#include <ncurses.h>
+#include <stdbool.h>
+#include <time.h>
+#include "../include/lua_config.h"
 // indirectly used
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 
-// validate that connection
-void validate_connection(struct mpd_connection *conn);
+// how long a single mpd call may block before the connection counts as dead
+#define MPD_TIMEOUT_MS 3000
+// reconnect delays, doubled after every failed attempt
+#define MPD_RETRY_MIN_MS 250
+#define MPD_RETRY_MAX_MS 30000
+// cmd is pinged this often, well inside mpd's default connection_timeout of 60s
+#define MPD_KEEPALIVE_MS 30000
 
+// The ui's two connections to mpd: one parked in idle that only tells us what changed,
+// one for every command the ui sends. If either breaks both are dropped and reconnected
+// with backoff; cmd stays a valid (failing) connection meanwhile so callers never see NULL.
+// mpd never times out a connection in idle, but it does close a quiet cmd, so cmd gets
+// a keepalive ping and is reopened on its own when mpd closed it anyway.
+typedef struct
+{
+    const Config *config;
+    struct mpd_connection *cmd;
+    struct mpd_connection *idle; // NULL while offline
+    enum mpd_idle mask;          // idle subscription, replayed on every new idle connection
+    bool idling;                 // an idle command is outstanding on idle
+    bool connected;
+    unsigned retry_ms;           // delay before the next attempt
+    struct timespec retry_at;    // CLOCK_MONOTONIC time of the next attempt
+    unsigned reconnects;         // successful reconnects since start
+    struct timespec pinged;      // CLOCK_MONOTONIC time cmd was last pinged or opened
+    bool cmd_reopened;           // mpd_link_check replaced cmd, whatever was sent on the old one got no answer
+} MpdLink;
 
-#endif
\ No newline at end of file
+// open a new connection the way config says, with MPD_TIMEOUT_MS (check it with mpd_connection_get_error)
+struct mpd_connection *open_connection(const Config *config);
+// conn failed at the connection level (closed by mpd, timed out, socket error); worth one reconnect and retry
+bool connection_lost(struct mpd_connection *conn);
+
+// connect both connections once, false leaves the link offline and retrying (or out of memory if cmd is NULL)
+bool mpd_link_open(MpdLink *link, const Config *config, enum mpd_idle mask);
+// drop both connections if either broke, true while still connected;
+// a cmd that mpd closed while idle is reopened alone and sets cmd_reopened
+bool mpd_link_check(MpdLink *link);
+// ping cmd if it wasn't for MPD_KEEPALIVE_MS, call it every now and then
+void mpd_link_keepalive(MpdLink *link);
+// reconnect if offline and the backoff ran out, true if this call brought the link back
+bool mpd_link_retry(MpdLink *link);
+// ms poll() may sleep before a retry is due, -1 while connected
+int mpd_link_retry_timeout(const MpdLink *link);
+// fd that turns readable once mpd has idle events (sends idle first if needed), -1 while offline
+int mpd_link_idle_fd(MpdLink *link);
+// read the events after the idle fd turned readable
+enum mpd_idle mpd_link_idle_events(MpdLink *link);
+// close both connections
+void mpd_link_close(MpdLink *link);
+
+#endif
@@ -0,0 +1,44 @@
+#ifndef QUEUE_LIST_H
+#define QUEUE_LIST_H
+
+// directly used
+#include <mpd/client.h>
+#include <stdbool.h>
+// indirectly used
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// one queue position, the title is only fetched once the row is on screen
+typedef struct
+{
+    unsigned id;
+    char *title; // "artist - title" (or the file name), NULL until loaded
+} QueueEntry;
+
+// Our copy of mpd's queue, one entry per position.
+// Only positions that changed since version are asked for on a change, and only the
+// rows being looked at carry metadata, so a huge queue never comes over in one piece.
+typedef struct
+{
+    QueueEntry *entries;
+    int length;
+    int capacity;
+    unsigned version; // queue version the entries are valid for
+    bool synced; // false until the first sync (and after a reset)
+} QueueList;
+
+// start empty and unsynced
+void queue_list_init(QueueList *list);
+// forget everything, the next sync starts over (e.g. after reconnecting)
+void queue_list_reset(QueueList *list);
+// bring the positions up to version/length, dropping titles of the rows that changed
+bool queue_list_sync(QueueList *list, struct mpd_connection *conn, unsigned version, int length);
+// fetch titles for the rows in [start, end) that don't have one yet, in one range request
+bool queue_list_load(QueueList *list, struct mpd_connection *conn, int start, int end);
+// title of the row at pos, NULL if not loaded
+const char *queue_list_title(const QueueList *list, int pos);
+// release everything
+void queue_list_free(QueueList *list);
+
+#endif
@@ -0,0 +1,77 @@
+#ifndef SEARCH_H
+#define SEARCH_H
+
+// directly used
+#include <mpd/client.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "../include/library.h"
+// indirectly used
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// most terms a query may have, the rest is ignored
+#define SEARCH_MAX_TERMS 8
+// results asked from mpd when there is no index to search
+#define SEARCH_SERVER_LIMIT 500
+
+typedef enum
+{
+    SEARCH_ARTIST,
+    SEARCH_ALBUM,
+    SEARCH_TITLE,
+    SEARCH_DATE,
+    SEARCH_FIELDS
+} SearchField;
+
+// songs of every distinct value of one tag
+typedef struct
+{
+    LibStr *values;
+    uint32_t *offsets;  // postings of values[i] are postings[offsets[i] .. offsets[i + 1])
+    uint32_t *postings; // song indices, ascending within each value
+    uint32_t value_count;
+    char *folded;       // every value lowercased, NUL separated, scanned in one go per term
+    uint32_t *starts;   // values[i] starts at folded[starts[i]], starts[value_count] is the end
+} TagPostings;
+
+// Inverted index over the library's interned tag values, built on first use.
+// A term unions the posting lists of every value it matches, terms are then
+// intersected smallest first with a galloping merge.
+typedef struct
+{
+    const Library *library;
+    TagPostings fields[SEARCH_FIELDS];
+    uint64_t *bitmap; // one bit per song, scratch for unions
+    bool built;
+} SearchIndex;
+
+// matches of the last query: library song indices, or uris and labels straight from mpd
+typedef struct
+{
+    uint32_t *songs; // ascending, library order
+    char **uris;     // only when the server answered
+    char **labels;
+    int count;
+    bool from_server;
+} SearchResults;
+
+// empty index over library, nothing is built until search_index_build
+void search_index_init(SearchIndex *index, const Library *library);
+// build the posting lists from the loaded library
+bool search_index_build(SearchIndex *index);
+// drop the posting lists, e.g. after the library was replaced
+void search_index_free(SearchIndex *index);
+// answer query ("artist:radiohead album:kid year:2000", bare words match artist, album or title) from the index
+bool search_run_index(SearchIndex *index, const char *query, SearchResults *results);
+// same query as a windowed mpd search, when no index is loaded
+bool search_run_server(struct mpd_connection *conn, const char *query, SearchResults *results);
+// uri of result i
+const char *search_result_uri(const SearchResults *results, const Library *library, int i);
+// "artist - title (album)" of result i
+void search_result_label(const SearchResults *results, const Library *library, int i, char *label, size_t size);
+// forget the results
+void search_results_clear(SearchResults *results);
+
+#endif
@@ -0,0 +1,34 @@
+#ifndef SELECTION_H
+#define SELECTION_H
+
+// directly used
+#include <stdbool.h>
+// indirectly used
+#include <stdlib.h>
+#include <string.h>
+
+// Set of marked uris (songs or directories), kept across directory changes.
+// uris keeps the order things were marked in, table is an open addressing index into it.
+typedef struct
+{
+    char **uris;
+    int count;
+    int capacity;
+    int *table; // -1 for an empty slot
+    int table_size; // power of two, at least twice count
+} Selection;
+
+// start empty
+void selection_init(Selection *selection);
+// is uri marked?
+bool selection_contains(const Selection *selection, const char *uri);
+// mark uri if it isn't, false on out of memory
+bool selection_add(Selection *selection, const char *uri);
+// mark or unmark uri, returns whether it is marked now
+bool selection_toggle(Selection *selection, const char *uri);
+// hand the marked uris to the caller (who frees each and the array) and start over empty
+char **selection_take(Selection *selection, int *count);
+// unmark everything
+void selection_clear(Selection *selection);
+
+#endif
@@ -0,0 +1,69 @@
+#ifndef SPECTRUM_H
+#define SPECTRUM_H
+
+// directly used
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+// indirectly used
+#include <stdlib.h>
+#include <string.h>
+
+// samples per analysis, 21.5 Hz per bin at 44.1 kHz
+#define SPECTRUM_FFT_SIZE 2048
+// frames analysed per second of audio
+#define SPECTRUM_FPS 60
+#define SPECTRUM_MAX_BANDS 256
+// frames the ui may fall behind by, a power of two
+#define SPECTRUM_RING 8
+// what mpd's fifo output writes unless the config says otherwise, always 16 bit stereo
+#define DEFAULT_SPECTRUM_RATE 44100
+
+// band levels between 0 (-60 dB and below) and 1 (full scale), lowest frequency first
+typedef struct
+{
+    float levels[SPECTRUM_MAX_BANDS];
+    int count;
+} SpectrumFrame;
+
+// Reads PCM from mpd's fifo output on its own thread and turns every 1/SPECTRUM_FPS s of it
+// into a frame of log spaced bands (Hann window, radix-2 FFT, peaks falling back slowly).
+// Frames go to the ui through a single producer / single consumer ring without locks,
+// event_fd only wakes the ui up. A regular file works in place of the fifo and is read in real time.
+typedef struct
+{
+    pthread_t thread;
+    char *path;
+    int rate;
+    atomic_int bands; // wanted by the ui, the footer's width
+    atomic_bool quit;
+
+    SpectrumFrame ring[SPECTRUM_RING];
+    atomic_uint head; // next slot to write, only moved by the thread
+    atomic_uint tail; // next slot to read, only moved by the ui
+    int event_fd;
+
+    // analysis state, only touched by the thread
+    float window[SPECTRUM_FFT_SIZE];
+    float samples[SPECTRUM_FFT_SIZE]; // last SPECTRUM_FFT_SIZE mono samples, oldest first
+    float re[SPECTRUM_FFT_SIZE];
+    float im[SPECTRUM_FFT_SIZE];
+    float cos_table[SPECTRUM_FFT_SIZE / 2];
+    float sin_table[SPECTRUM_FFT_SIZE / 2];
+    uint16_t bit_reverse[SPECTRUM_FFT_SIZE];
+    int edges[SPECTRUM_MAX_BANDS + 1]; // first bin of every band, for edge_count bands
+    int edge_count;
+    float levels[SPECTRUM_MAX_BANDS]; // what was last published, decays between peaks
+} Spectrum;
+
+// start reading path (a fifo of rate Hz, 16 bit stereo), it may show up later
+bool spectrum_start(Spectrum *spectrum, const char *path, int rate);
+// how many bands the next frames should have (ui thread)
+void spectrum_set_bands(Spectrum *spectrum, int bands);
+// newest frame into out, skipping older ones; false if nothing new (ui thread)
+bool spectrum_take(Spectrum *spectrum, SpectrumFrame *out);
+// stop and join the thread
+void spectrum_stop(Spectrum *spectrum);
+
+#endif
@@ -4,11 +4,24 @@
 // direct includes
 #include <ncurses.h>
 #include <mpd/client.h>
-#include <mpd/albumart.h>
-#include <mpd/readpicture.h>
 #include <unistd.h>
 #include <errno.h>
 #include "../include/ascii_art.h"
+#include "../include/album_art.h"
+#include "../include/art_worker.h"
+#include "../include/cmd_worker.h"
+#include "../include/art_cache.h"
+#include "../include/art_pack.h"
+#include "../include/dir_cache.h"
+#include "../include/library.h"
+#include "../include/library_worker.h"
+#include "../include/search.h"
+#include "../include/fuzzy.h"
+#include "../include/spectrum.h"
+#include "../include/selection.h"
+#include "../include/queue_list.h"
+#include "../include/mpd_connections.h"
+#include "../include/viewport.h"
 // indirect includes
 #include <stdlib.h>
 #include <string.h>
@@ -16,9 +29,22 @@
 
 
 // macros
-#define MAX_ITEMS 1000
 #define MAX_PATH 256
 #define TAB_COUNT 4
+// what wakes the main loop up from mpd's side
+#define IDLE_EVENTS (MPD_IDLE_PLAYER | MPD_IDLE_QUEUE | MPD_IDLE_DATABASE | MPD_IDLE_MIXER | MPD_IDLE_OPTIONS)
+
+// regions of the screen that can be repainted on their own
+#define DIRTY_CLOCK     (1u << 0) // header clock text
+#define DIRTY_TABS      (1u << 1) // whole header (tab bar + clock)
+#define DIRTY_MAIN      (1u << 2) // whole main area
+#define DIRTY_SELECTION (1u << 3) // highlighted row of the directory browser
+#define DIRTY_INPUT     (1u << 4) // directory selection input line
+#define DIRTY_FOOTER    (1u << 5) // status / visualizer / message line
+#define DIRTY_ALL       (DIRTY_TABS | DIRTY_MAIN | DIRTY_INPUT | DIRTY_FOOTER)
+
+// the spectrum repaints the footer at most this often, frames in between are skipped
+#define SPECTRUM_REDRAW_NS (1000000000L / SPECTRUM_FPS)
 
 typedef enum
 {
@@ -37,16 +63,67 @@ typedef struct
     int max_rows;
     int max_cols;
     char *current_directory;
-    char **item_uris;
-    int *item_types; // 0 for dir, 1 for song
-    int item_count;
+    DirCache dir_cache;
+    Library library; // whole database, mapped from the last run's snapshot or loaded on database changes
+    LibraryWorker *library_worker; // NULL if the worker couldn't start, the index then loads inline
+    bool show_search; // '/' search mode, keys edit the query
+    SearchIndex search_index; // posting lists over library, built by the first query
+    SearchResults search_results;
+    char search_query[MAX_PATH];
+    int search_pos;
+    int search_selected;
+    Viewport search_view;
+    double search_ms; // how long the last query took
+    FuzzyFinder *fuzzy; // NULL if the finder couldn't start
+    bool show_jump; // 'j' fuzzy jump overlay, keys edit the pattern
+    char jump_query[FUZZY_QUERY_MAX];
+    int jump_pos;
+    FuzzyMatch jump_results[FUZZY_MAX_RESULTS]; // best so far, refreshed as the finder reports
+    int jump_count;
+    uint32_t jump_scanned;
+    int jump_selected;
+    Viewport jump_view;
+    const DirListing *listing; // listing of current_directory, owned by dir_cache
     int selected_index;
+    Viewport dir_view; // scroll position of the directory browser
+    Selection marked; // entries marked with space, across directories
+    QueueList queue; // synced when the queue tab is drawn
+    int queue_selected;
+    Viewport queue_view; // scroll position of the queue tab
     bool show_directory_browser;
     bool show_directory_selection;
 		bool show_help;
     char input_buffer[MAX_PATH];
     int input_pos;
 		Tab current_tab;
+    struct mpd_status *status; // last status snapshot
+    struct mpd_song *current_song; // last current song snapshot
+    unsigned progress_ms; // elapsed time of the current song as of progress_time
+    struct timespec progress_time; // CLOCK_MONOTONIC, while playing elapsed runs on from here without asking mpd
+    unsigned dirty; // DIRTY_* regions waiting for ui_render()
+    int drawn_selected; // row highlighted on screen right now
+    char message[128]; // last command result shown in the footer
+    CommandWorker *cmd_worker; // NULL if the worker couldn't start, commands then run inline
+    enum mpd_state play_state; // what the footer shows, runs ahead of status while commands are in flight
+    int commands_in_flight;
+    bool status_deferred; // status was refreshed while commands were in flight, play_state takes it once they're done
+    bool command_failed; // mpd rejected the last command, flagged in the footer until one succeeds
+    bool offline; // lost mpd, the footer says we're reconnecting
+    ArtWorker *art_worker; // NULL if the worker couldn't start
+    ArtCache art_cache; // rendered covers, sized by main from the config
+    ArtPack art_pack; // covers from earlier runs, opened by main
+    ArtMode art_mode;
+    char *art_album; // cache key of the current song's cover (NULL for none)
+    int art_width;
+    int art_height;
+    time_t art_mtime; // mtime of the song the cover is for
+    ArtTransfer art_transfer; // cost of the last cover fetched from mpd
+    int art_song_id; // song id art was requested for (-1 for none)
+    int prefetch_song_id; // next song id whose art was prefetched (-1 for none)
+    bool art_loading;
+    Spectrum *spectrum; // NULL without a visualizer fifo in the config
+    SpectrumFrame spectrum_frame; // newest bands, drawn while playing
+    struct timespec spectrum_drawn; // when the footer last showed a frame
 } UI;
 
 // initialize the ui after setting up ncurses
@@ -55,22 +132,49 @@ void init_ui(const char *starting_directory, UI *ui);
 void clean_tui(UI* ui);
 // updates time and current tab
 void update_header(UI* ui);
+// updates only the clock in the header
+void update_clock(UI* ui);
 // browse music dir
 void update_directory_browser(struct mpd_connection *conn, UI* ui);
+// moves the browser highlight, repainting only the rows that changed
+void update_browser_selection(struct mpd_connection *conn, UI* ui);
 // updates directory screen
 void update_directory_selection(UI* ui);
 //help
 void help_screen(UI *ui);
+// search query and results, drawn over whatever tab is open
+void update_search_view(UI* ui);
+// fuzzy jump pattern and the matches found so far, drawn over the directory tab
+void update_jump_view(UI* ui);
+// queue tab, catches up with mpd's queue and loads the visible rows
+void update_queue_view(struct mpd_connection *conn, UI* ui);
 // update main tab with basic info (expand with album art)
 void update_main_area(struct mpd_connection *conn, UI* ui);
 // update footer with fun animation when music plays
-void update_footer(struct mpd_connection *conn, UI* ui);
+void update_footer(UI* ui);
+// refresh cached status and current song (one round trip)
+void refresh_player_state(struct mpd_connection *conn, UI* ui);
+// show the current song's cover if it changed, asking the art worker when it isn't cached,
+// and prefetch the next song's
+void request_album_art(struct mpd_connection *conn, UI* ui);
+// take a finished cover from the art worker
+void receive_album_art(UI* ui);
+// pick up matches the fuzzy finder merged since the last look
+void receive_jump_results(UI* ui);
+// take the newest spectrum frame, repainting the footer if the last one was long enough ago
+void receive_spectrum(UI* ui);
+// settle optimistic playback state with the command worker's results
+void receive_command_results(UI* ui);
+// flag regions for repaint
+void ui_mark_dirty(UI* ui, unsigned regions);
+// show a message in the footer
+void ui_set_message(UI* ui, const char *fmt, ...);
+// repaint dirty regions and flush them in one doupdate()
+void ui_render(struct mpd_connection *conn, UI* ui);
 // runs whole tui process (Gets called from main)
-void run_tui(struct mpd_connection *conn, UI* ui);
+void run_tui(MpdLink *link, UI* ui);
 // get dir up
 char *get_parent_directory(const char *path);
-// fetch curr album art
-int fetch_album_art(struct mpd_connection *conn, const char *temp_file);
 
 
 #endif
\ No newline at end of file
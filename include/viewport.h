@@ -0,0 +1,18 @@
+#ifndef VIEWPORT_H
+#define VIEWPORT_H
+
+// the window of rows of a list that is actually on screen
+typedef struct
+{
+    int offset; // first visible row
+    int rows;   // how many rows fit
+} Viewport;
+
+// scroll just enough that selected is visible
+void viewport_follow(Viewport *view, int selected, int count);
+// move selected by a number of pages (negative is up), clamped to the list
+int viewport_page(const Viewport *view, int selected, int pages, int count);
+// last visible row (exclusive) given count items
+int viewport_end(const Viewport *view, int count);
+
+#endif
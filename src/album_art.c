@@ -0,0 +1,197 @@
+#include "../include/album_art.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// cover files we can decode, in the order we try them
+static const char *const cover_names[] = {
+    "cover.jpg", "folder.jpg", "cover.jpeg", "folder.jpeg", "front.jpg",
+    "Cover.jpg", "Folder.jpg", "Front.jpg", "AlbumArt.jpg",
+};
+
+void art_buffer_init(ArtBuffer *buffer)
+{
+    buffer->data = NULL;
+    buffer->size = 0;
+    buffer->capacity = 0;
+}
+
+bool art_buffer_reserve(ArtBuffer *buffer, size_t size)
+{
+    if (buffer->size + size > buffer->capacity)
+    {
+        size_t capacity = buffer->capacity ? buffer->capacity : ART_CHUNK_SIZE;
+        while (capacity < buffer->size + size) capacity *= 2;
+
+        unsigned char *grown = realloc(buffer->data, capacity);
+        if (!grown) return false;
+        buffer->data = grown;
+        buffer->capacity = capacity;
+    }
+    return true;
+}
+
+bool art_buffer_append(ArtBuffer *buffer, const void *data, size_t size)
+{
+    if (!art_buffer_reserve(buffer, size)) return false;
+    memcpy(buffer->data + buffer->size, data, size);
+    buffer->size += size;
+    return true;
+}
+
+void art_buffer_free(ArtBuffer *buffer)
+{
+    free(buffer->data);
+    art_buffer_init(buffer);
+}
+
+size_t art_negotiate_chunk_size(struct mpd_connection *conn)
+{
+    // binarylimit is mpd 0.22.4+, older servers stay at their default
+    if (mpd_connection_cmp_server_version(conn, 0, 22, 4) < 0)
+    {
+        return ART_CHUNK_SIZE;
+    }
+    if (!mpd_run_binarylimit(conn, ART_BINARY_LIMIT))
+    {
+        mpd_connection_clear_error(conn);
+        return ART_CHUNK_SIZE;
+    }
+    return ART_BINARY_LIMIT;
+}
+
+typedef int (*ArtChunkFn)(struct mpd_connection *conn, const char *uri, unsigned offset, void *buffer, size_t buffer_size);
+
+// pull every chunk of one picture straight into buffer, -1 on error or when cancelled
+static int fetch_chunks(struct mpd_connection *conn, ArtChunkFn run, const char *uri, ArtBuffer *buffer,
+                        ArtTransfer *transfer, ArtContinueFn keep_going, void *arg)
+{
+    // every command returns the chunk at offset, an empty chunk means we're done
+    int bytes_read;
+    do
+    {
+        // the server never sends more than the negotiated limit, so receive in place
+        if (!art_buffer_reserve(buffer, transfer->chunk_size))
+        {
+            return -1;
+        }
+        bytes_read = run(conn, uri, (unsigned)buffer->size, buffer->data + buffer->size, transfer->chunk_size);
+        transfer->round_trips++;
+        if (bytes_read > 0)
+        {
+            buffer->size += bytes_read;
+            transfer->bytes += bytes_read;
+            if (keep_going && !keep_going(arg))
+            {
+                return -1;
+            }
+        }
+    } while (bytes_read > 0);
+
+    return bytes_read < 0 || mpd_connection_get_error(conn) != MPD_ERROR_SUCCESS ? -1 : 0;
+}
+
+int fetch_song_art(struct mpd_connection *conn, const char *uri, ArtBuffer *buffer, ArtTransfer *transfer,
+                   ArtContinueFn keep_going, void *arg)
+{
+    // this may run off the ui thread, so failures are reported by return value only
+    ArtTransfer local = { 0 };
+    if (!transfer) transfer = &local;
+    if (transfer->chunk_size == 0) transfer->chunk_size = ART_CHUNK_SIZE;
+    transfer->from_folder = false;
+
+    int result = fetch_chunks(conn, mpd_run_readpicture, uri, buffer, transfer, keep_going, arg);
+    // mpd before 0.22 doesn't know readpicture, and a decoder may choke on the embedded picture;
+    // both are server errors that leave the connection fine for albumart
+    if (result < 0 && mpd_connection_get_error(conn) == MPD_ERROR_SERVER && mpd_connection_clear_error(conn))
+    {
+        buffer->size = 0;
+        result = 0;
+    }
+    if (result == 0 && buffer->size == 0 && (!keep_going || keep_going(arg)))
+    {
+        // no embedded picture, try cover.jpg and friends next to the song
+        transfer->from_folder = true;
+        result = fetch_chunks(conn, mpd_run_albumart, uri, buffer, transfer, keep_going, arg);
+    }
+
+    if (result < 0)
+    {
+        mpd_connection_clear_error(conn);
+    }
+    if (result < 0 || buffer->size == 0)
+    {
+        art_buffer_free(buffer);
+        return -1;
+    }
+    return 0;
+}
+
+char *art_query_music_root(struct mpd_connection *conn)
+{
+    // mpd only answers "config" to clients on a local socket
+    char *root = NULL;
+    if (mpd_send_command(conn, "config", NULL))
+    {
+        struct mpd_pair *pair;
+        while ((pair = mpd_recv_pair(conn)) != NULL)
+        {
+            if (!root && strcmp(pair->name, "music_directory") == 0)
+            {
+                root = strdup(pair->value);
+            }
+            mpd_return_pair(conn, pair);
+        }
+        mpd_response_finish(conn);
+    }
+    mpd_connection_clear_error(conn);
+    return root;
+}
+
+bool art_map_local_cover(const char *music_root, const char *uri, ArtMapping *mapping)
+{
+    const char *slash = strrchr(uri, '/');
+    int dir_len = slash ? (int)(slash - uri) : 0;
+    char path[4096];
+
+    for (size_t i = 0; i < sizeof(cover_names) / sizeof(cover_names[0]); i++)
+    {
+        int len = dir_len ? snprintf(path, sizeof(path), "%s/%.*s/%s", music_root, dir_len, uri, cover_names[i])
+                          : snprintf(path, sizeof(path), "%s/%s", music_root, cover_names[i]);
+        if (len < 0 || (size_t)len >= sizeof(path))
+        {
+            return false;
+        }
+
+        int fd = open(path, O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+        {
+            continue;
+        }
+        struct stat st;
+        void *data = MAP_FAILED;
+        if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0)
+        {
+            data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        }
+        // the mapping keeps the file alive on its own
+        close(fd);
+        if (data == MAP_FAILED)
+        {
+            continue;
+        }
+        madvise(data, (size_t)st.st_size, MADV_SEQUENTIAL);
+        mapping->data = data;
+        mapping->size = (size_t)st.st_size;
+        return true;
+    }
+    return false;
+}
+
+void art_unmap_cover(ArtMapping *mapping)
+{
+    if (mapping->data) munmap((void *)mapping->data, mapping->size);
+    mapping->data = NULL;
+    mapping->size = 0;
+}
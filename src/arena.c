@@ -0,0 +1,70 @@
+#include "../include/arena.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define ARENA_ALIGN (sizeof(void*))
+
+void arena_init(Arena *arena, size_t block_size)
+{
+    arena->head = NULL;
+    arena->block_size = block_size ? block_size : ARENA_BLOCK_SIZE;
+}
+
+void *arena_alloc(Arena *arena, size_t size)
+{
+    size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+
+    // oversized requests get a block of their own, kept behind the one being filled
+    if (size > arena->block_size)
+    {
+        ArenaBlock *big = malloc(sizeof(ArenaBlock) + size);
+        if (!big) return NULL;
+        big->used = big->size = size;
+        if (arena->head)
+        {
+            big->next = arena->head->next;
+            arena->head->next = big;
+        }
+        else
+        {
+            big->next = NULL;
+            arena->head = big;
+        }
+        return big->data;
+    }
+
+    ArenaBlock *block = arena->head;
+    if (!block || block->size - block->used < size)
+    {
+        block = malloc(sizeof(ArenaBlock) + arena->block_size);
+        if (!block) return NULL;
+        block->used = 0;
+        block->size = arena->block_size;
+        block->next = arena->head;
+        arena->head = block;
+    }
+
+    void *ptr = block->data + block->used;
+    block->used += size;
+    return ptr;
+}
+
+char *arena_strdup(Arena *arena, const char *str)
+{
+    size_t len = strlen(str) + 1;
+    char *copy = arena_alloc(arena, len);
+    if (copy) memcpy(copy, str, len);
+    return copy;
+}
+
+void arena_free(Arena *arena)
+{
+    ArenaBlock *block = arena->head;
+    while (block)
+    {
+        ArenaBlock *next = block->next;
+        free(block);
+        block = next;
+    }
+    arena->head = NULL;
+}
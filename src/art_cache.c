@@ -0,0 +1,168 @@
+#include "../include/art_cache.h"
+
+// FNV-1a over the album path, mixed with the size and mode
+static unsigned hash_key(const char *album, int width, int height, ArtMode mode)
+{
+    unsigned hash = 2166136261u;
+    for (const unsigned char *p = (const unsigned char *)album; *p; p++)
+    {
+        hash ^= *p;
+        hash *= 16777619u;
+    }
+    hash ^= (unsigned)width * 31u + (unsigned)height * 131u + (unsigned)mode;
+    hash *= 16777619u;
+    return hash % ART_CACHE_BUCKETS;
+}
+
+static bool key_matches(const ArtCacheEntry *entry, const char *album, int width, int height, ArtMode mode)
+{
+    return entry->width == width && entry->height == height && entry->mode == mode && strcmp(entry->album, album) == 0;
+}
+
+// rough heap footprint of one entry
+static size_t entry_bytes(const char *album, const AsciiArt *art)
+{
+    size_t bytes = sizeof(ArtCacheEntry) + strlen(album) + 1;
+    if (art)
+    {
+        bytes += sizeof(AsciiArt) + (size_t)art->num_lines * sizeof(char *);
+        for (int i = 0; i < art->num_lines; i++)
+        {
+            bytes += strlen(art->lines[i]) + 1;
+        }
+    }
+    return bytes;
+}
+
+// unlink from the lru list
+static void lru_unlink(ArtCache *cache, ArtCacheEntry *entry)
+{
+    if (entry->prev) entry->prev->next = entry->next;
+    else cache->head = entry->next;
+    if (entry->next) entry->next->prev = entry->prev;
+    else cache->tail = entry->prev;
+    entry->prev = entry->next = NULL;
+}
+
+// put at the most recently used end
+static void lru_push_front(ArtCache *cache, ArtCacheEntry *entry)
+{
+    entry->prev = NULL;
+    entry->next = cache->head;
+    if (cache->head) cache->head->prev = entry;
+    cache->head = entry;
+    if (!cache->tail) cache->tail = entry;
+}
+
+// remove an entry from both the list and its bucket
+static void remove_entry(ArtCache *cache, ArtCacheEntry *victim)
+{
+    ArtCacheEntry **slot = &cache->buckets[hash_key(victim->album, victim->width, victim->height, victim->mode)];
+    while (*slot != victim) slot = &(*slot)->chain;
+    *slot = victim->chain;
+
+    if (cache->pinned == victim) cache->pinned = NULL;
+    lru_unlink(cache, victim);
+    cache->bytes -= victim->bytes;
+    ascii_art_free(victim->art);
+    free(victim->album);
+    free(victim);
+}
+
+static ArtCacheEntry *find(const ArtCache *cache, const char *album, int width, int height, ArtMode mode)
+{
+    for (ArtCacheEntry *entry = cache->buckets[hash_key(album, width, height, mode)]; entry; entry = entry->chain)
+    {
+        if (key_matches(entry, album, width, height, mode)) return entry;
+    }
+    return NULL;
+}
+
+void art_cache_init(ArtCache *cache, size_t budget)
+{
+    memset(cache, 0, sizeof(ArtCache));
+    cache->budget = budget;
+}
+
+void art_cache_clear(ArtCache *cache)
+{
+    while (cache->tail)
+    {
+        remove_entry(cache, cache->tail);
+    }
+}
+
+char *art_cache_album(const char *uri)
+{
+    const char *slash = strrchr(uri, '/');
+    return slash ? strndup(uri, (size_t)(slash - uri)) : strdup("");
+}
+
+bool art_cache_lookup(ArtCache *cache, const char *album, int width, int height, ArtMode mode, const AsciiArt **art)
+{
+    ArtCacheEntry *entry = find(cache, album, width, height, mode);
+    if (!entry)
+    {
+        cache->misses++;
+        return false;
+    }
+    cache->hits++;
+    lru_unlink(cache, entry);
+    lru_push_front(cache, entry);
+    *art = entry->art;
+    return true;
+}
+
+const AsciiArt *art_cache_peek(const ArtCache *cache, const char *album, int width, int height, ArtMode mode)
+{
+    ArtCacheEntry *entry = find(cache, album, width, height, mode);
+    return entry ? entry->art : NULL;
+}
+
+bool art_cache_contains(const ArtCache *cache, const char *album, int width, int height, ArtMode mode)
+{
+    return find(cache, album, width, height, mode) != NULL;
+}
+
+void art_cache_pin(ArtCache *cache, const char *album, int width, int height, ArtMode mode)
+{
+    cache->pinned = find(cache, album, width, height, mode);
+}
+
+void art_cache_insert(ArtCache *cache, const char *album, int width, int height, ArtMode mode, AsciiArt *art)
+{
+    ArtCacheEntry *old = find(cache, album, width, height, mode);
+    if (old) remove_entry(cache, old);
+
+    ArtCacheEntry *entry = calloc(1, sizeof(ArtCacheEntry));
+    char *copy = strdup(album);
+    if (!entry || !copy)
+    {
+        free(entry);
+        free(copy);
+        ascii_art_free(art);
+        return;
+    }
+    entry->album = copy;
+    entry->width = width;
+    entry->height = height;
+    entry->mode = mode;
+    entry->art = art;
+    entry->bytes = entry_bytes(album, art);
+
+    // make room, the new entry itself always stays even if it alone is over budget
+    while (cache->bytes + entry->bytes > cache->budget)
+    {
+        ArtCacheEntry *victim = cache->tail;
+        if (victim && victim == cache->pinned) victim = victim->prev;
+        if (!victim) break;
+        remove_entry(cache, victim);
+        cache->evictions++;
+    }
+
+    unsigned bucket = hash_key(album, width, height, mode);
+    entry->chain = cache->buckets[bucket];
+    cache->buckets[bucket] = entry;
+    lru_push_front(cache, entry);
+    cache->bytes += entry->bytes;
+}
@@ -0,0 +1,507 @@
+#include "../include/art_pack.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// records are padded so the next header stays aligned in the mapping
+#define RECORD_ALIGN 8
+
+static uint32_t fnv1a(uint32_t hash, const void *data, size_t size)
+{
+    const unsigned char *p = data;
+    for (size_t i = 0; i < size; i++)
+    {
+        hash ^= p[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// covers the header with checksum taken as 0, so a torn or flipped key, size or mtime is caught too
+static uint32_t record_checksum(const ArtPackRecord *record, const void *payload)
+{
+    ArtPackRecord header = *record;
+    header.checksum = 0;
+    uint32_t hash = fnv1a(2166136261u, &header, sizeof(header));
+    return fnv1a(hash, payload, record->length - sizeof(ArtPackRecord));
+}
+
+static uint32_t hash_key(const char *album, size_t album_len, int width, int height, ArtMode mode)
+{
+    uint32_t hash = fnv1a(2166136261u, album, album_len);
+    uint32_t dims[3] = { (uint32_t)width, (uint32_t)height, (uint32_t)mode };
+    return fnv1a(hash, dims, sizeof(dims));
+}
+
+static const ArtPackRecord *record_at(const ArtPack *pack, uint64_t offset)
+{
+    return (const ArtPackRecord *)(pack->map + offset);
+}
+
+static bool record_matches(const ArtPackRecord *record, const char *album, size_t album_len, int width, int height, ArtMode mode)
+{
+    return record->width == width && record->height == height && record->mode == mode &&
+           record->album_len == album_len && memcmp(record + 1, album, album_len) == 0;
+}
+
+// keep the mapping as long as the file, appends made through the fd grow it
+static bool ensure_mapped(ArtPack *pack)
+{
+    if (pack->map && pack->map_size == pack->file_size)
+    {
+        return true;
+    }
+    if (pack->map) munmap(pack->map, pack->map_size);
+    pack->map = mmap(NULL, pack->file_size, PROT_READ, MAP_SHARED, pack->fd, 0);
+    if (pack->map == MAP_FAILED)
+    {
+        pack->map = NULL;
+        pack->map_size = 0;
+        return false;
+    }
+    pack->map_size = pack->file_size;
+    return true;
+}
+
+static void clear_index(ArtPack *pack)
+{
+    for (int i = 0; i < ART_PACK_BUCKETS; i++)
+    {
+        ArtPackSlot *slot = pack->buckets[i];
+        while (slot)
+        {
+            ArtPackSlot *next = slot->chain;
+            free(slot);
+            slot = next;
+        }
+        pack->buckets[i] = NULL;
+    }
+    pack->live_bytes = 0;
+}
+
+static ArtPackSlot *find_slot(const ArtPack *pack, uint32_t hash, const char *album, size_t album_len, int width, int height, ArtMode mode)
+{
+    for (ArtPackSlot *slot = pack->buckets[hash % ART_PACK_BUCKETS]; slot; slot = slot->chain)
+    {
+        if (slot->hash == hash && record_matches(record_at(pack, slot->offset), album, album_len, width, height, mode))
+        {
+            return slot;
+        }
+    }
+    return NULL;
+}
+
+// point the key of record, which lives at offset, to it, shadowing an older record;
+// record may be a copy when the mapping doesn't reach offset yet
+static void index_record(ArtPack *pack, uint64_t offset, const ArtPackRecord *record)
+{
+    const char *album = (const char *)(record + 1);
+    uint32_t hash = hash_key(album, record->album_len, record->width, record->height, record->mode);
+
+    ArtPackSlot *slot = find_slot(pack, hash, album, record->album_len, record->width, record->height, record->mode);
+    if (slot)
+    {
+        pack->live_bytes -= slot->length;
+    }
+    else
+    {
+        slot = calloc(1, sizeof(ArtPackSlot));
+        if (!slot) return;
+        slot->hash = hash;
+        slot->chain = pack->buckets[hash % ART_PACK_BUCKETS];
+        pack->buckets[hash % ART_PACK_BUCKETS] = slot;
+    }
+    slot->offset = offset;
+    slot->length = record->length;
+    pack->live_bytes += record->length;
+}
+
+// walk every record to rebuild the index, a torn record at the end (crash mid append) is cut off
+static void scan(ArtPack *pack)
+{
+    size_t offset = sizeof(ArtPackHeader);
+    while (offset + sizeof(ArtPackRecord) <= pack->file_size)
+    {
+        const ArtPackRecord *record = record_at(pack, offset);
+        if (record->magic != ART_PACK_RECORD_MAGIC || record->length < sizeof(ArtPackRecord) ||
+            record->length % RECORD_ALIGN != 0 || record->length > pack->file_size - offset ||
+            sizeof(ArtPackRecord) + record->album_len > record->length ||
+            record_checksum(record, record + 1) != record->checksum)
+        {
+            break;
+        }
+        index_record(pack, offset, record);
+        offset += record->length;
+    }
+
+    if (offset < pack->file_size && ftruncate(pack->fd, (off_t)offset) == 0)
+    {
+        pack->file_size = offset;
+        ensure_mapped(pack);
+    }
+}
+
+// empty file with just a header
+static bool write_header(int fd)
+{
+    ArtPackHeader header = { .version = ART_PACK_VERSION };
+    memcpy(header.magic, ART_PACK_MAGIC, sizeof(header.magic));
+    return ftruncate(fd, 0) == 0 && pwrite(fd, &header, sizeof(header), 0) == (ssize_t)sizeof(header);
+}
+
+static void close_fd(ArtPack *pack)
+{
+    if (pack->map) munmap(pack->map, pack->map_size);
+    pack->map = NULL;
+    pack->map_size = 0;
+    if (pack->fd >= 0) close(pack->fd);
+    pack->fd = -1;
+    pack->file_size = 0;
+    clear_index(pack);
+}
+
+// take over fd as the pack file: check the header, map it and index it
+static bool adopt_fd(ArtPack *pack, int fd)
+{
+    pack->fd = fd;
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+    {
+        close_fd(pack);
+        return false;
+    }
+
+    ArtPackHeader header;
+    if ((size_t)st.st_size < sizeof(header) || pread(fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header) ||
+        memcmp(header.magic, ART_PACK_MAGIC, sizeof(header.magic)) != 0 || header.version != ART_PACK_VERSION)
+    {
+        // new, foreign or an older format, start over
+        if (!write_header(fd))
+        {
+            close_fd(pack);
+            return false;
+        }
+        st.st_size = sizeof(header);
+    }
+
+    pack->file_size = (size_t)st.st_size;
+    if (!ensure_mapped(pack))
+    {
+        close_fd(pack);
+        return false;
+    }
+    scan(pack);
+    return true;
+}
+
+// mkdir -p for the directory part of path
+static void make_parents(char *path)
+{
+    for (char *p = path + 1; *p; p++)
+    {
+        if (*p != '/') continue;
+        *p = '\0';
+        mkdir(path, 0755);
+        *p = '/';
+    }
+}
+
+char *art_pack_default_path(void)
+{
+    const char *cache = getenv("XDG_CACHE_HOME");
+    const char *home = getenv("HOME");
+    char path[4096];
+    if (cache && cache[0] == '/')
+    {
+        snprintf(path, sizeof(path), "%s/orpheus/art.pack", cache);
+    }
+    else if (home)
+    {
+        snprintf(path, sizeof(path), "%s/.cache/orpheus/art.pack", home);
+    }
+    else
+    {
+        return NULL;
+    }
+    make_parents(path);
+    return strdup(path);
+}
+
+bool art_pack_open(ArtPack *pack, const char *path, size_t limit)
+{
+    memset(pack, 0, sizeof(ArtPack));
+    pthread_mutex_init(&pack->lock, NULL);
+    pack->fd = -1;
+    pack->limit = limit;
+    if (!path || limit == 0)
+    {
+        return false;
+    }
+
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0)
+    {
+        return false;
+    }
+    // a second orpheus would append to the same file, that one runs without the pack
+    if (flock(fd, LOCK_EX | LOCK_NB) != 0)
+    {
+        close(fd);
+        return false;
+    }
+    pack->path = strdup(path);
+    if (!pack->path)
+    {
+        close(fd);
+        return false;
+    }
+    return adopt_fd(pack, fd);
+}
+
+// under lock
+static bool lookup_locked(ArtPack *pack, const char *album, int width, int height, ArtMode mode, time_t song_mtime, AsciiArt **art)
+{
+    // stores append through the fd, the mapping catches up here
+    if (pack->fd < 0 || !ensure_mapped(pack))
+    {
+        return false;
+    }
+    size_t album_len = strlen(album);
+    ArtPackSlot *slot = find_slot(pack, hash_key(album, album_len, width, height, mode), album, album_len, width, height, mode);
+    if (!slot)
+    {
+        return false;
+    }
+    const ArtPackRecord *record = record_at(pack, slot->offset);
+    // the song changed since, its picture may have too
+    if (record->mtime < (int64_t)song_mtime)
+    {
+        return false;
+    }
+
+    *art = NULL;
+    if (record->num_lines == 0)
+    {
+        return true;
+    }
+
+    AsciiArt *copy = calloc(1, sizeof(AsciiArt));
+    if (!copy) return false;
+    copy->lines = calloc(record->num_lines, sizeof(char *));
+    if (!copy->lines)
+    {
+        free(copy);
+        return false;
+    }
+    copy->max_width = record->max_width;
+
+    const char *p = (const char *)(record + 1) + record->album_len;
+    const char *end = (const char *)record + record->length;
+    for (int i = 0; i < record->num_lines; i++)
+    {
+        const char *nul = memchr(p, '\0', (size_t)(end - p));
+        if (!nul || !(copy->lines[i] = strndup(p, (size_t)(nul - p))))
+        {
+            ascii_art_free(copy);
+            return false;
+        }
+        copy->num_lines++;
+        p = nul + 1;
+    }
+    *art = copy;
+    return true;
+}
+
+bool art_pack_lookup(ArtPack *pack, const char *album, int width, int height, ArtMode mode, time_t song_mtime, AsciiArt **art)
+{
+    pthread_mutex_lock(&pack->lock);
+    bool found = lookup_locked(pack, album, width, height, mode, song_mtime, art);
+    pthread_mutex_unlock(&pack->lock);
+    return found;
+}
+
+bool art_pack_try_lookup(ArtPack *pack, const char *album, int width, int height, ArtMode mode, time_t song_mtime, AsciiArt **art)
+{
+    if (pthread_mutex_trylock(&pack->lock) != 0)
+    {
+        return false;
+    }
+    bool found = lookup_locked(pack, album, width, height, mode, song_mtime, art);
+    pthread_mutex_unlock(&pack->lock);
+    return found;
+}
+
+static int compare_offset_desc(const void *a, const void *b)
+{
+    uint64_t x = (*(ArtPackSlot *const *)a)->offset;
+    uint64_t y = (*(ArtPackSlot *const *)b)->offset;
+    return x < y ? 1 : x > y ? -1 : 0;
+}
+
+static int compare_offset_asc(const void *a, const void *b)
+{
+    return compare_offset_desc(b, a);
+}
+
+// rewrite the pack with only live records, newest first until a quarter of the limit is free
+static void compact(ArtPack *pack, size_t incoming)
+{
+    size_t count = 0;
+    for (int i = 0; i < ART_PACK_BUCKETS; i++)
+    {
+        for (ArtPackSlot *slot = pack->buckets[i]; slot; slot = slot->chain) count++;
+    }
+    ArtPackSlot **slots = malloc((count ? count : 1) * sizeof(ArtPackSlot *));
+    size_t tmp_len = strlen(pack->path) + 5;
+    char *tmp = malloc(tmp_len);
+    if (!slots || !tmp)
+    {
+        free(slots);
+        free(tmp);
+        return;
+    }
+    count = 0;
+    for (int i = 0; i < ART_PACK_BUCKETS; i++)
+    {
+        for (ArtPackSlot *slot = pack->buckets[i]; slot; slot = slot->chain) slots[count++] = slot;
+    }
+
+    size_t target = pack->limit / 4 * 3;
+    size_t kept_bytes = sizeof(ArtPackHeader) + incoming;
+    size_t kept = 0;
+    qsort(slots, count, sizeof(ArtPackSlot *), compare_offset_desc);
+    while (kept < count && kept_bytes + slots[kept]->length <= target)
+    {
+        kept_bytes += slots[kept++]->length;
+    }
+    // write them back in their original order so the scan sees the same shadowing
+    qsort(slots, kept, sizeof(ArtPackSlot *), compare_offset_asc);
+
+    snprintf(tmp, tmp_len, "%s.tmp", pack->path);
+    int fd = open(tmp, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    bool ok = fd >= 0 && flock(fd, LOCK_EX | LOCK_NB) == 0 && write_header(fd);
+    off_t out = sizeof(ArtPackHeader);
+    for (size_t i = 0; ok && i < kept; i++)
+    {
+        ok = pwrite(fd, pack->map + slots[i]->offset, slots[i]->length, out) == (ssize_t)slots[i]->length;
+        out += slots[i]->length;
+    }
+    ok = ok && rename(tmp, pack->path) == 0;
+    free(slots);
+
+    if (!ok)
+    {
+        // couldn't rewrite, dropping everything still keeps us under the limit
+        if (fd >= 0)
+        {
+            close(fd);
+            unlink(tmp);
+        }
+        free(tmp);
+        clear_index(pack);
+        if (!write_header(pack->fd))
+        {
+            close_fd(pack);
+            return;
+        }
+        pack->file_size = sizeof(ArtPackHeader);
+        if (!ensure_mapped(pack)) close_fd(pack);
+        return;
+    }
+    free(tmp);
+    close_fd(pack);
+    adopt_fd(pack, fd);
+}
+
+void art_pack_store(ArtPack *pack, const char *album, int width, int height, ArtMode mode, time_t song_mtime, const AsciiArt *art)
+{
+    size_t album_len = strlen(album);
+    if (album_len > UINT16_MAX || width > UINT16_MAX || height > UINT16_MAX)
+    {
+        return;
+    }
+
+    size_t length = sizeof(ArtPackRecord) + album_len;
+    int num_lines = art ? art->num_lines : 0;
+    for (int i = 0; i < num_lines; i++)
+    {
+        length += strlen(art->lines[i]) + 1;
+    }
+    length = (length + RECORD_ALIGN - 1) / RECORD_ALIGN * RECORD_ALIGN;
+    if (num_lines > UINT16_MAX || length > pack->limit / 2)
+    {
+        return;
+    }
+
+    unsigned char *buffer = calloc(1, length);
+    if (!buffer) return;
+    ArtPackRecord *record = (ArtPackRecord *)buffer;
+    record->magic = ART_PACK_RECORD_MAGIC;
+    record->length = (uint32_t)length;
+    record->mtime = (int64_t)song_mtime;
+    record->album_len = (uint16_t)album_len;
+    record->width = (uint16_t)width;
+    record->height = (uint16_t)height;
+    record->num_lines = (uint16_t)num_lines;
+    record->max_width = art ? (uint16_t)art->max_width : 0;
+    record->mode = (uint8_t)mode;
+
+    unsigned char *p = buffer + sizeof(ArtPackRecord);
+    memcpy(p, album, album_len);
+    p += album_len;
+    for (int i = 0; i < num_lines; i++)
+    {
+        size_t size = strlen(art->lines[i]) + 1;
+        memcpy(p, art->lines[i], size);
+        p += size;
+    }
+    record->checksum = record_checksum(record, buffer + sizeof(ArtPackRecord));
+
+    pthread_mutex_lock(&pack->lock);
+    // the index compares against records already in the file, they have to be mapped
+    if (pack->fd < 0 || !ensure_mapped(pack))
+    {
+        pthread_mutex_unlock(&pack->lock);
+        free(buffer);
+        return;
+    }
+    if (pack->file_size + length > pack->limit)
+    {
+        compact(pack, length);
+        if (pack->fd < 0)
+        {
+            pthread_mutex_unlock(&pack->lock);
+            free(buffer);
+            return;
+        }
+    }
+
+    size_t offset = pack->file_size;
+    if (pwrite(pack->fd, buffer, length, (off_t)offset) != (ssize_t)length)
+    {
+        // don't leave half a record for the next scan to trip over
+        if (ftruncate(pack->fd, (off_t)offset) != 0)
+        {
+            close_fd(pack);
+        }
+    }
+    else
+    {
+        // indexed from our copy, the mapping grows on the next lookup
+        pack->file_size += length;
+        index_record(pack, offset, record);
+    }
+    pthread_mutex_unlock(&pack->lock);
+    free(buffer);
+}
+
+void art_pack_close(ArtPack *pack)
+{
+    close_fd(pack);
+    free(pack->path);
+    pack->path = NULL;
+    pthread_mutex_destroy(&pack->lock);
+}
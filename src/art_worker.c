@@ -0,0 +1,326 @@
+#include "../include/art_worker.h"
+#include "../include/art_cache.h"
+#include "../include/mpd_connections.h"
+#include <stdint.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+typedef struct
+{
+    ArtWorker *worker;
+    unsigned generation;
+} Job;
+
+// still the newest request? checked between readpicture chunks
+static bool job_is_current(void *arg)
+{
+    Job *job = arg;
+    return atomic_load(&job->worker->generation) == job->generation;
+}
+
+// (re)connect if we never did or the last command broke the connection
+static bool ensure_connection(ArtWorker *worker)
+{
+    if (worker->conn && mpd_connection_get_error(worker->conn) == MPD_ERROR_SUCCESS)
+    {
+        return true;
+    }
+    if (worker->conn) mpd_connection_free(worker->conn);
+    worker->conn = open_connection(worker->config);
+    if (worker->conn && mpd_connection_get_error(worker->conn) == MPD_ERROR_SUCCESS)
+    {
+        // fewer, bigger chunks; the limit sticks to this connection only
+        worker->chunk_size = art_negotiate_chunk_size(worker->conn);
+        if (!worker->music_root && !worker->asked_music_root &&
+            worker->config->connection_type && strcmp(worker->config->connection_type, "socket") == 0)
+        {
+            worker->music_root = art_query_music_root(worker->conn);
+            worker->asked_music_root = true;
+        }
+        return true;
+    }
+    if (worker->conn) mpd_connection_free(worker->conn);
+    worker->conn = NULL;
+    return false;
+}
+
+// push onto the result stack, the ui takes the whole stack at once
+static void publish(ArtWorker *worker, ArtResult *result)
+{
+    ArtResult *head = atomic_load(&worker->results);
+    do
+    {
+        result->next = head;
+    } while (!atomic_compare_exchange_weak(&worker->results, &head, result));
+
+    uint64_t one = 1;
+    if (write(worker->event_fd, &one, sizeof(one)) < 0)
+    {
+        // the counter can only overflow if the ui stopped reading, nothing to do
+    }
+}
+
+static bool same_request(const ArtRequest *a, const char *uri, int width, int height, ArtMode mode)
+{
+    return a->uri && a->width == width && a->height == height && a->mode == mode && strcmp(a->uri, uri) == 0;
+}
+
+static void clear_request(ArtRequest *request)
+{
+    free(request->uri);
+    request->uri = NULL;
+}
+
+// fetch, decode and fill in result
+static void run_job(ArtWorker *worker, ArtResult *result, Job *job, const char *album)
+{
+    const ArtRequest *request = &result->request;
+
+    // the ui skips the pack while it's being written, here we can wait for it
+    if (album && art_pack_lookup(worker->pack, album, request->width, request->height, request->mode, request->mtime, &result->art))
+    {
+        result->from_pack = true;
+        return;
+    }
+    bool connected = ensure_connection(worker);
+
+    // same machine as mpd: decode the cover file in place, no protocol round trips
+    ArtMapping cover;
+    if (worker->music_root && art_map_local_cover(worker->music_root, request->uri, &cover))
+    {
+        result->art = jpeg_to_ascii(cover.data, cover.size, request->width, request->height, request->mode);
+        result->transfer.bytes = cover.size;
+        result->transfer.from_folder = true;
+        result->transfer.local = true;
+        art_unmap_cover(&cover);
+        if (result->art) return;
+    }
+
+    if (!connected)
+    {
+        result->failed = true;
+        return;
+    }
+    for (int attempt = 0; ; attempt++)
+    {
+        ArtBuffer picture;
+        art_buffer_init(&picture);
+        result->transfer.chunk_size = worker->chunk_size;
+        if (fetch_song_art(worker->conn, request->uri, &picture, &result->transfer, job_is_current, job) == 0 && job_is_current(job))
+        {
+            result->art = jpeg_to_ascii(picture.data, picture.size, request->width, request->height, request->mode);
+        }
+        art_buffer_free(&picture);
+        // a connection mpd dropped while we were quiet fails the first fetch after it, reconnect and go again once
+        if (attempt == 0 && connection_lost(worker->conn) && job_is_current(job))
+        {
+            mpd_connection_free(worker->conn);
+            worker->conn = NULL;
+            if (ensure_connection(worker)) continue;
+        }
+        break;
+    }
+    // server errors were cleared by the fetch, anything left broke the connection
+    result->failed = !worker->conn || mpd_connection_get_error(worker->conn) != MPD_ERROR_SUCCESS;
+}
+
+static void *worker_main(void *arg)
+{
+    ArtWorker *worker = arg;
+
+    for (;;)
+    {
+        pthread_mutex_lock(&worker->lock);
+        while (!worker->pending && !worker->prefetch_pending && !worker->quit)
+        {
+            pthread_cond_wait(&worker->wake, &worker->lock);
+        }
+        if (worker->quit)
+        {
+            pthread_mutex_unlock(&worker->lock);
+            break;
+        }
+        // the cover on screen always goes before the one for the next song
+        ArtResult *result = calloc(1, sizeof(ArtResult));
+        if (worker->pending)
+        {
+            if (result) result->request = worker->current;
+            else free(worker->current.uri);
+            worker->current.uri = NULL;
+            worker->pending = false;
+        }
+        else
+        {
+            if (result) result->request = worker->prefetch;
+            else free(worker->prefetch.uri);
+            worker->prefetch.uri = NULL;
+            worker->prefetch_pending = false;
+            if (result) result->prefetch = true;
+        }
+        Job job = { worker, atomic_load(&worker->generation) };
+        if (result)
+        {
+            worker->active = result->request;
+            worker->active_prefetch = result->prefetch;
+        }
+        pthread_mutex_unlock(&worker->lock);
+
+        if (!result)
+        {
+            continue;
+        }
+        char *album = art_cache_album(result->request.uri);
+        run_job(worker, result, &job, album);
+
+        pthread_mutex_lock(&worker->lock);
+        worker->active.uri = NULL;
+        pthread_mutex_unlock(&worker->lock);
+
+        // a newer request is already queued, don't bother the ui with this one
+        if (!job_is_current(&job))
+        {
+            free(album);
+            art_result_free(result);
+            continue;
+        }
+        // a missing cover is stored too so the next run won't ask again, but not when mpd was unreachable
+        if (album && !result->failed && !result->from_pack)
+        {
+            const ArtRequest *request = &result->request;
+            art_pack_store(worker->pack, album, request->width, request->height, request->mode, request->mtime, result->art);
+        }
+        free(album);
+        publish(worker, result);
+    }
+
+    if (worker->conn) mpd_connection_free(worker->conn);
+    worker->conn = NULL;
+    return NULL;
+}
+
+bool art_worker_start(ArtWorker *worker, const Config *config, ArtPack *pack)
+{
+    memset(worker, 0, sizeof(ArtWorker));
+    worker->config = config;
+    worker->pack = pack;
+    worker->music_root = config->music_root ? strdup(config->music_root) : NULL;
+    atomic_init(&worker->generation, 0);
+    atomic_init(&worker->results, NULL);
+
+    worker->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (worker->event_fd < 0)
+    {
+        free(worker->music_root);
+        return false;
+    }
+    pthread_mutex_init(&worker->lock, NULL);
+    pthread_cond_init(&worker->wake, NULL);
+    if (pthread_create(&worker->thread, NULL, worker_main, worker) != 0)
+    {
+        pthread_mutex_destroy(&worker->lock);
+        pthread_cond_destroy(&worker->wake);
+        close(worker->event_fd);
+        free(worker->music_root);
+        return false;
+    }
+    return true;
+}
+
+void art_worker_request(ArtWorker *worker, const char *uri, time_t mtime, int width, int height, ArtMode mode)
+{
+    pthread_mutex_lock(&worker->lock);
+    if (same_request(&worker->prefetch, uri, width, height, mode))
+    {
+        // we got to the song before its prefetch started, it's asked for right here
+        clear_request(&worker->prefetch);
+        worker->prefetch_pending = false;
+    }
+    if (same_request(&worker->active, uri, width, height, mode))
+    {
+        // usually the prefetch of the song we just switched to, let it finish
+        clear_request(&worker->current);
+        worker->pending = false;
+        pthread_mutex_unlock(&worker->lock);
+        return;
+    }
+
+    // bumping the generation is what cancels a fetch already in flight,
+    // a prefetch we cut short goes back in line behind this request
+    if (worker->active.uri && worker->active_prefetch && !worker->prefetch_pending)
+    {
+        worker->prefetch = worker->active;
+        worker->prefetch.uri = strdup(worker->active.uri);
+        worker->prefetch_pending = worker->prefetch.uri != NULL;
+    }
+    atomic_fetch_add(&worker->generation, 1);
+    free(worker->current.uri);
+    worker->current = (ArtRequest){ strdup(uri), mtime, width, height, mode };
+    worker->pending = worker->current.uri != NULL;
+    pthread_cond_signal(&worker->wake);
+    pthread_mutex_unlock(&worker->lock);
+}
+
+void art_worker_prefetch(ArtWorker *worker, const char *uri, time_t mtime, int width, int height, ArtMode mode)
+{
+    pthread_mutex_lock(&worker->lock);
+    if (!same_request(&worker->active, uri, width, height, mode) && !same_request(&worker->current, uri, width, height, mode))
+    {
+        free(worker->prefetch.uri);
+        worker->prefetch = (ArtRequest){ strdup(uri), mtime, width, height, mode };
+        worker->prefetch_pending = worker->prefetch.uri != NULL;
+        pthread_cond_signal(&worker->wake);
+    }
+    pthread_mutex_unlock(&worker->lock);
+}
+
+ArtResult *art_worker_take(ArtWorker *worker)
+{
+    uint64_t count;
+    if (read(worker->event_fd, &count, sizeof(count)) < 0)
+    {
+        // EAGAIN, nothing was posted since the last take
+    }
+    // the stack is newest first, hand it out in the order it was produced
+    ArtResult *newest = atomic_exchange(&worker->results, NULL);
+    ArtResult *oldest = NULL;
+    while (newest)
+    {
+        ArtResult *next = newest->next;
+        newest->next = oldest;
+        oldest = newest;
+        newest = next;
+    }
+    return oldest;
+}
+
+void art_result_free(ArtResult *result)
+{
+    if (!result) return;
+    ascii_art_free(result->art);
+    free(result->request.uri);
+    free(result);
+}
+
+void art_worker_stop(ArtWorker *worker)
+{
+    pthread_mutex_lock(&worker->lock);
+    worker->quit = true;
+    atomic_fetch_add(&worker->generation, 1);
+    pthread_cond_signal(&worker->wake);
+    pthread_mutex_unlock(&worker->lock);
+    pthread_join(worker->thread, NULL);
+
+    clear_request(&worker->current);
+    clear_request(&worker->prefetch);
+    free(worker->music_root);
+    ArtResult *result = atomic_exchange(&worker->results, NULL);
+    while (result)
+    {
+        ArtResult *next = result->next;
+        art_result_free(result);
+        result = next;
+    }
+    pthread_mutex_destroy(&worker->lock);
+    pthread_cond_destroy(&worker->wake);
+    close(worker->event_fd);
+}
@@ -1,35 +1,93 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <setjmp.h>
 #include <jpeglib.h>
 #include "../include/ascii_art.h"
+#include "../include/downsample.h"
 
-AsciiArt *jpeg_to_ascii(const char *image_path, int ascii_width, int max_height) 
+// libjpeg's default error handler exit()s, jump back to jpeg_to_ascii instead
+typedef struct
+{
+    struct jpeg_error_mgr pub;
+    jmp_buf escape;
+} JpegError;
+
+static void jpeg_error_exit(j_common_ptr cinfo)
+{
+    JpegError *err = (JpegError *)cinfo->err;
+    longjmp(err->escape, 1);
+}
+
+// warnings would land in the middle of the curses screen, drop them
+static void jpeg_silent_message(j_common_ptr cinfo)
+{
+    (void)cinfo;
+}
+
+// Largest 1/denom (8, 4, 2) whose output is still at least grid_width x grid_height pixels
+static unsigned int pick_scale_denom(unsigned int width, unsigned int height, int grid_width, int grid_height)
+{
+    for (unsigned int denom = 8; denom > 1; denom /= 2)
+    {
+        // libjpeg rounds the scaled size up
+        unsigned int scaled_width = (width + denom - 1) / denom;
+        unsigned int scaled_height = (height + denom - 1) / denom;
+        if (scaled_width >= (unsigned int)grid_width && scaled_height >= (unsigned int)grid_height)
+        {
+            return denom;
+        }
+    }
+    return 1;
+}
+
+AsciiArt *jpeg_to_ascii(const unsigned char *data, size_t size, int ascii_width, int max_height, ArtMode mode) 
 {
     // Validate inputs
-    if (!image_path || ascii_width <= 0 || max_height <= 0) 
+    if (!data || size == 0 || ascii_width <= 0 || max_height <= 0) 
     {
         return NULL;
     }
 
     // Initialize libjpeg structures
     struct jpeg_decompress_struct cinfo;
-    struct jpeg_error_mgr jerr;
-    cinfo.err = jpeg_std_error(&jerr);
-    jpeg_create_decompress(&cinfo);
-
-    // Open JPEG file
-    FILE *infile = fopen(image_path, "rb");
-    if (!infile) 
+    JpegError jerr;
+    cinfo.err = jpeg_std_error(&jerr.pub);
+    jerr.pub.error_exit = jpeg_error_exit;
+    jerr.pub.output_message = jpeg_silent_message;
+    // ds lives in memory (its address escapes), the flag is volatile so it survives the longjmp
+    Downsampler ds;
+    volatile bool have_ds = false;
+    if (setjmp(jerr.escape))
     {
+        // corrupt or truncated image
         jpeg_destroy_decompress(&cinfo);
+        if (have_ds) downsampler_free(&ds);
         return NULL;
     }
+    jpeg_create_decompress(&cinfo);
 
-    // Set up JPEG source and read header
-    jpeg_stdio_src(&cinfo, infile);
+    // Decode straight from the bytes mpd sent us
+    jpeg_mem_src(&cinfo, data, size);
     jpeg_read_header(&cinfo, TRUE);
 
+    // Calculate ASCII art height, adjusting for 2:1 character aspect ratio
+    float aspect_ratio = (float)cinfo.image_height / cinfo.image_width;
+    int ascii_height = (int)(aspect_ratio * ascii_width / 2.0 + 0.5);
+    if (ascii_height > max_height) 
+    {
+        ascii_height = max_height;
+    }
+    if (ascii_height < 1)
+    {
+        ascii_height = 1;
+    }
+
+    // Let the IDCT scale down as far as possible while still covering the grid
+    cinfo.scale_num = 1;
+    cinfo.scale_denom = pick_scale_denom(cinfo.image_width, cinfo.image_height, ascii_width, ascii_height);
+    cinfo.dct_method = JDCT_IFAST;
+
     // Convert to grayscale
     cinfo.out_color_space = JCS_GRAYSCALE;
     jpeg_start_decompress(&cinfo);
@@ -38,49 +96,37 @@ AsciiArt *jpeg_to_ascii(const char *image_path, int ascii_width, int max_height)
     int height = cinfo.output_height;
     int row_stride = cinfo.output_width * cinfo.output_components;
 
-    // Allocate image data array
-    unsigned char *image = malloc(width * height);
-    if (!image) 
+    // Every scanline is folded into per-cell sums as it is decoded, nothing else is kept
+    if (!downsampler_init(&ds, width, height, ascii_width, ascii_height))
     {
-        fclose(infile);
         jpeg_destroy_decompress(&cinfo);
         return NULL;
     }
+    have_ds = true;
 
     // Read image data
     JSAMPARRAY buffer = (*cinfo.mem->alloc_sarray)((j_common_ptr)&cinfo, JPOOL_IMAGE, row_stride, 1);
-    int y = 0;
     while (cinfo.output_scanline < cinfo.output_height) 
     {
         jpeg_read_scanlines(&cinfo, buffer, 1);
-        memcpy(image + y * width, buffer[0], width);
-        y++;
+        downsampler_push_row(&ds, buffer[0]);
     }
 
     // Clean up JPEG
     jpeg_finish_decompress(&cinfo);
     jpeg_destroy_decompress(&cinfo);
-    fclose(infile);
-
-    // Calculate ASCII art height, adjusting for 2:1 character aspect ratio
-    float aspect_ratio = (float)height / width;
-    int ascii_height = (int)(aspect_ratio * ascii_width / 2.0 + 0.5);
-    if (ascii_height > max_height) 
-    {
-        ascii_height = max_height;
-    }
 
     // Allocate AsciiArt structure
     AsciiArt *art = malloc(sizeof(AsciiArt));
     if (!art) 
     {
-        free(image);
+        downsampler_free(&ds);
         return NULL;
     }
     art->lines = malloc(ascii_height * sizeof(char *));
     if (!art->lines) 
     {
-        free(image);
+        downsampler_free(&ds);
         free(art);
         return NULL;
     }
@@ -92,36 +138,36 @@ AsciiArt *jpeg_to_ascii(const char *image_path, int ascii_width, int max_height)
             for (int j = 0; j < i; j++) free(art->lines[j]);
             free(art->lines);
             free(art);
-            free(image);
+            downsampler_free(&ds);
             return NULL;
         }
     }
     art->num_lines = ascii_height;
     art->max_width = ascii_width;
 
-    // ASCII characters from dark to light
+    // ASCII characters from dark to light, looked up per luminance instead of divided per pixel
     const char *ascii_chars = "@%#*+=-:. ";
     int num_chars = strlen(ascii_chars);
+    char glyphs[256];
+    for (int v = 0; v < 256; v++)
+    {
+        int idx = (v * (num_chars - 1)) / 255;
+        glyphs[v] = ascii_chars[mode == ART_MODE_INVERTED ? num_chars - 1 - idx : idx];
+    }
 
-    // Generate ASCII art
+    // Generate ASCII art from the mean luminance of each cell
     for (int r = 0; r < ascii_height; r++) 
     {
+        const unsigned char *row = ds.means + r * ascii_width;
         for (int c = 0; c < ascii_width; c++) 
         {
-            // Sample the corresponding pixel
-            int x = (c * width) / ascii_width;
-            int y = (r * height) / ascii_height;
-            unsigned char pixel = image[y * width + x];
-
-            // Map pixel value (0-255) to an ASCII character index
-            int idx = (pixel * (num_chars - 1)) / 255;
-            art->lines[r][c] = ascii_chars[idx];
+            art->lines[r][c] = glyphs[row[c]];
         }
         art->lines[r][ascii_width] = '\0'; // Null-terminate each line
     }
 
     // Clean up
-    free(image);
+    downsampler_free(&ds);
     return art;
 }
 
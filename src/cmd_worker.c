@@ -0,0 +1,319 @@
+#include "../include/cmd_worker.h"
+#include "../include/mpd_connections.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+// (re)connect if we never did or the last command broke the connection
+static bool ensure_connection(CommandWorker *worker)
+{
+    if (worker->conn && mpd_connection_get_error(worker->conn) == MPD_ERROR_SUCCESS)
+    {
+        return true;
+    }
+    if (worker->conn) mpd_connection_free(worker->conn);
+    worker->conn = open_connection(worker->config);
+    if (worker->conn && mpd_connection_get_error(worker->conn) == MPD_ERROR_SUCCESS)
+    {
+        return true;
+    }
+    if (worker->conn) mpd_connection_free(worker->conn);
+    worker->conn = NULL;
+    return false;
+}
+
+bool command_run(struct mpd_connection *conn, CommandOp op, unsigned position, char *error, size_t error_size)
+{
+    bool ok = false;
+    switch (op)
+    {
+        case CMD_PLAY:
+            ok = mpd_run_play(conn);
+            break;
+        case CMD_PAUSE:
+            ok = mpd_run_pause(conn, true);
+            break;
+        case CMD_NEXT:
+            ok = mpd_run_next(conn);
+            break;
+        case CMD_PREVIOUS:
+            ok = mpd_run_previous(conn);
+            break;
+        case CMD_PLAY_POS:
+            ok = mpd_run_play_pos(conn, position);
+            break;
+        case CMD_ADD:
+            break;
+    }
+    if (!ok)
+    {
+        snprintf(error, error_size, "%s", mpd_connection_get_error_message(conn));
+        mpd_connection_clear_error(conn);
+    }
+    return ok;
+}
+
+int command_run_add(struct mpd_connection *conn, char *const *uris, int count, char *error, size_t error_size,
+                    void (*progress)(void *arg, int done, int total), void *arg)
+{
+    // one round trip per batch instead of one per uri
+    int done = 0;
+    while (done < count)
+    {
+        int batch = count - done < ADD_BATCH_SIZE ? count - done : ADD_BATCH_SIZE;
+        bool ok = mpd_command_list_begin(conn, false);
+        for (int i = 0; ok && i < batch; i++)
+        {
+            ok = mpd_send_add(conn, uris[done + i]);
+        }
+        ok = ok && mpd_command_list_end(conn) && mpd_response_finish(conn);
+        if (!ok)
+        {
+            // mpd stops a list at the first failing command, the ones before it stay added
+            snprintf(error, error_size, "%s", mpd_connection_get_error_message(conn));
+            mpd_connection_clear_error(conn);
+            return done;
+        }
+        done += batch;
+        if (progress) progress(arg, done, count);
+    }
+    return done;
+}
+
+// commands run one at a time, so progress waiting at the end of the ring belongs to the add posting now
+// and is replaced rather than queued behind; with enqueue capping outstanding commands the ring never fills
+static void post_result(CommandWorker *worker, const CommandResult *result)
+{
+    pthread_mutex_lock(&worker->lock);
+    int last = (worker->results_head + worker->results_count - 1) % COMMAND_QUEUE_SIZE;
+    if (worker->results_count > 0 && result->op == CMD_ADD &&
+        worker->results[last].op == CMD_ADD && !worker->results[last].final)
+    {
+        worker->results[last] = *result;
+    }
+    else
+    {
+        worker->results[(worker->results_head + worker->results_count) % COMMAND_QUEUE_SIZE] = *result;
+        worker->results_count++;
+    }
+    pthread_mutex_unlock(&worker->lock);
+
+    uint64_t one = 1;
+    if (write(worker->event_fd, &one, sizeof(one)) < 0)
+    {
+        // the counter can only overflow if the ui stopped reading, nothing to do
+    }
+}
+
+// where a (possibly replayed) add stands within the whole command
+typedef struct
+{
+    CommandWorker *worker;
+    int offset; // uris added before this run of command_run_add
+    int total;
+} AddProgress;
+
+// a batch of an add went through, let the ui show how far along it is
+static void post_progress(void *arg, int done, int total)
+{
+    const AddProgress *add = arg;
+    (void)total;
+    done += add->offset;
+    CommandResult result = { .op = CMD_ADD, .ok = true, .final = done == add->total, .done = done, .total = add->total };
+    post_result(add->worker, &result);
+}
+
+// true if the command provably never reached mpd and the replay should go ahead on a fresh connection
+static bool reconnect_for_replay(CommandWorker *worker)
+{
+    // mpd closes a connection that was quiet for its connection_timeout, the first command after
+    // a pause finds it gone. A timeout or socket error may have lost only the reply to a command mpd
+    // already ran, replaying would skip two songs or add a batch twice; those are reported and the
+    // next player event shows what happened. Server errors were cleared by the command.
+    if (mpd_connection_get_error(worker->conn) != MPD_ERROR_CLOSED)
+    {
+        return false;
+    }
+    mpd_connection_free(worker->conn);
+    worker->conn = NULL;
+    return ensure_connection(worker);
+}
+
+static void free_command(Command *command)
+{
+    for (int i = 0; i < command->count; i++)
+    {
+        free(command->uris[i]);
+    }
+    free(command->uris);
+    command->uris = NULL;
+    command->count = 0;
+}
+
+static void *worker_main(void *arg)
+{
+    CommandWorker *worker = arg;
+
+    for (;;)
+    {
+        pthread_mutex_lock(&worker->lock);
+        while (worker->queue_count == 0 && !worker->quit)
+        {
+            pthread_cond_wait(&worker->wake, &worker->lock);
+        }
+        if (worker->quit)
+        {
+            pthread_mutex_unlock(&worker->lock);
+            break;
+        }
+        Command command = worker->queue[worker->queue_head];
+        worker->queue_head = (worker->queue_head + 1) % COMMAND_QUEUE_SIZE;
+        worker->queue_count--;
+        pthread_mutex_unlock(&worker->lock);
+
+        CommandResult result = { .op = command.op, .final = true, .total = command.count };
+        if (!ensure_connection(worker))
+        {
+            snprintf(result.error, sizeof(result.error), "can't reach mpd");
+            post_result(worker, &result);
+        }
+        else if (command.op != CMD_ADD)
+        {
+            result.ok = command_run(worker->conn, command.op, command.position, result.error, sizeof(result.error));
+            if (!result.ok && reconnect_for_replay(worker))
+            {
+                result.ok = command_run(worker->conn, command.op, command.position, result.error, sizeof(result.error));
+            }
+            post_result(worker, &result);
+        }
+        else
+        {
+            AddProgress add = { worker, 0, command.count };
+            result.done = command_run_add(worker->conn, command.uris, command.count, result.error, sizeof(result.error),
+                                          post_progress, &add);
+            // batches that went through stay added, the replay picks up after them
+            if (result.done < command.count && reconnect_for_replay(worker))
+            {
+                add.offset = result.done;
+                result.done += command_run_add(worker->conn, command.uris + add.offset, command.count - add.offset,
+                                               result.error, sizeof(result.error), post_progress, &add);
+            }
+            // the last batch already reported success
+            if (result.done < command.count || command.count == 0)
+            {
+                post_result(worker, &result);
+            }
+        }
+        free_command(&command);
+    }
+
+    if (worker->conn) mpd_connection_free(worker->conn);
+    worker->conn = NULL;
+    return NULL;
+}
+
+bool cmd_worker_start(CommandWorker *worker, const Config *config)
+{
+    memset(worker, 0, sizeof(CommandWorker));
+    worker->config = config;
+
+    worker->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (worker->event_fd < 0)
+    {
+        return false;
+    }
+    pthread_mutex_init(&worker->lock, NULL);
+    pthread_cond_init(&worker->wake, NULL);
+    if (pthread_create(&worker->thread, NULL, worker_main, worker) != 0)
+    {
+        pthread_mutex_destroy(&worker->lock);
+        pthread_cond_destroy(&worker->wake);
+        close(worker->event_fd);
+        return false;
+    }
+    return true;
+}
+
+static bool enqueue(CommandWorker *worker, Command *command)
+{
+    pthread_mutex_lock(&worker->lock);
+    // each outstanding command can hold a result slot, this keeps room for all of them
+    bool queued = worker->outstanding < COMMAND_QUEUE_SIZE;
+    if (queued)
+    {
+        worker->queue[(worker->queue_head + worker->queue_count) % COMMAND_QUEUE_SIZE] = *command;
+        worker->queue_count++;
+        worker->outstanding++;
+        pthread_cond_signal(&worker->wake);
+    }
+    pthread_mutex_unlock(&worker->lock);
+    return queued;
+}
+
+bool cmd_worker_send(CommandWorker *worker, CommandOp op, unsigned position)
+{
+    Command command = { .op = op, .position = position };
+    return enqueue(worker, &command);
+}
+
+bool cmd_worker_send_add(CommandWorker *worker, char **uris, int count)
+{
+    Command command = { .op = CMD_ADD, .uris = uris, .count = count };
+    if (!enqueue(worker, &command))
+    {
+        free_command(&command);
+        return false;
+    }
+    return true;
+}
+
+int cmd_worker_take(CommandWorker *worker, CommandResult *out, int max)
+{
+    uint64_t count;
+    if (read(worker->event_fd, &count, sizeof(count)) < 0)
+    {
+        // EAGAIN, nothing was posted since the last take
+    }
+    pthread_mutex_lock(&worker->lock);
+    int taken = 0;
+    while (taken < max && worker->results_count > 0)
+    {
+        out[taken] = worker->results[worker->results_head];
+        if (out[taken++].final) worker->outstanding--;
+        worker->results_head = (worker->results_head + 1) % COMMAND_QUEUE_SIZE;
+        worker->results_count--;
+    }
+    bool more = worker->results_count > 0;
+    pthread_mutex_unlock(&worker->lock);
+
+    // whatever didn't fit keeps the fd readable
+    if (more)
+    {
+        uint64_t one = 1;
+        if (write(worker->event_fd, &one, sizeof(one)) < 0)
+        {
+            // can't overflow with results still pending
+        }
+    }
+    return taken;
+}
+
+void cmd_worker_stop(CommandWorker *worker)
+{
+    pthread_mutex_lock(&worker->lock);
+    worker->quit = true;
+    pthread_cond_signal(&worker->wake);
+    pthread_mutex_unlock(&worker->lock);
+    pthread_join(worker->thread, NULL);
+
+    while (worker->queue_count > 0)
+    {
+        free_command(&worker->queue[worker->queue_head]);
+        worker->queue_head = (worker->queue_head + 1) % COMMAND_QUEUE_SIZE;
+        worker->queue_count--;
+    }
+    pthread_mutex_destroy(&worker->lock);
+    pthread_cond_destroy(&worker->wake);
+    close(worker->event_fd);
+}
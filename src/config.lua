@@ -6,3 +6,15 @@ socket_path = "/home/bay/.config/mpd/socket"
 -- use these if you're on network
 -- host = "localhost"
 --port = 6600
+-- where covers can be read from directly, asked from mpd when on a socket
+-- music_root = "~/Music"
+
+-- album art
+art_cache_budget = 1024 -- KiB of rendered covers kept in memory
+art_mode = "ascii" -- or "inverted" for light terminals
+art_pack_limit = 16384 -- KiB of covers kept in ~/.cache/orpheus across restarts, 0 to disable
+
+-- footer spectrum, read from an mpd fifo output such as
+--   audio_output { type "fifo" name "visualizer" path "/tmp/mpd.fifo" format "44100:16:2" }
+-- visualizer_fifo = "/tmp/mpd.fifo"
+-- visualizer_rate = 44100 -- the rate in that format, samples are always 16 bit stereo
@@ -0,0 +1,199 @@
+#include "../include/dir_cache.h"
+
+// FNV-1a, good enough for directory paths
+static unsigned hash_path(const char *path)
+{
+    unsigned hash = 2166136261u;
+    for (const unsigned char *p = (const unsigned char *)path; *p; p++)
+    {
+        hash ^= *p;
+        hash *= 16777619u;
+    }
+    return hash % DIR_CACHE_BUCKETS;
+}
+
+// unlink from the lru list
+static void lru_unlink(DirCache *cache, DirCacheEntry *entry)
+{
+    if (entry->prev) entry->prev->next = entry->next;
+    else cache->head = entry->next;
+    if (entry->next) entry->next->prev = entry->prev;
+    else cache->tail = entry->prev;
+    entry->prev = entry->next = NULL;
+}
+
+// put at the most recently used end
+static void lru_push_front(DirCache *cache, DirCacheEntry *entry)
+{
+    entry->prev = NULL;
+    entry->next = cache->head;
+    if (cache->head) cache->head->prev = entry;
+    cache->head = entry;
+    if (!cache->tail) cache->tail = entry;
+}
+
+// remove a listing from both the list and its bucket, stopping the worker if it was filling it
+static void drop_entry(DirCache *cache, DirCacheEntry *victim)
+{
+    DirCacheEntry **slot = &cache->buckets[hash_path(victim->listing.path)];
+    while (*slot != victim) slot = &(*slot)->chain;
+    *slot = victim->chain;
+
+    if (victim == cache->streaming)
+    {
+        if (cache->worker) listing_worker_cancel(cache->worker);
+        cache->streaming = NULL;
+    }
+    lru_unlink(cache, victim);
+    dir_listing_free(&victim->listing);
+    free(victim);
+    cache->count--;
+}
+
+// remove the least recently used listing
+static void evict_oldest(DirCache *cache)
+{
+    if (cache->tail) drop_entry(cache, cache->tail);
+}
+
+// build path from the library, or fetch it from mpd, into a new entry
+static DirCacheEntry *fetch_entry(const DirCache *cache, struct mpd_connection *conn, const char *path)
+{
+    DirCacheEntry *entry = calloc(1, sizeof(DirCacheEntry));
+    if (!entry) return NULL;
+    if (!dir_listing_init(&entry->listing, path))
+    {
+        dir_listing_free(&entry->listing);
+        free(entry);
+        return NULL;
+    }
+    if (cache->library && cache->library->loaded && dir_listing_from_library(&entry->listing, cache->library))
+    {
+        return entry;
+    }
+    // a half built listing is started over from mpd
+    dir_listing_free(&entry->listing);
+    if (cache->worker && dir_listing_init(&entry->listing, path))
+    {
+        entry->listing.streaming = true;
+        listing_worker_request(cache->worker, path);
+        return entry;
+    }
+    if (!dir_listing_init(&entry->listing, path) || !dir_listing_fetch(&entry->listing, conn))
+    {
+        dir_listing_free(&entry->listing);
+        free(entry);
+        return NULL;
+    }
+    return entry;
+}
+
+void dir_cache_init(DirCache *cache)
+{
+    memset(cache, 0, sizeof(DirCache));
+}
+
+void dir_cache_clear(DirCache *cache)
+{
+    while (cache->tail)
+    {
+        evict_oldest(cache);
+    }
+    free(cache->failed);
+    cache->failed = NULL;
+}
+
+const DirListing *dir_cache_get(DirCache *cache, struct mpd_connection *conn, const char *path)
+{
+    // we left the folder before it finished, it starts over if we come back
+    if (cache->streaming && strcmp(cache->streaming->listing.path, path) != 0)
+    {
+        drop_entry(cache, cache->streaming);
+    }
+    // a failed folder is asked for again once we've been somewhere else
+    if (cache->failed && strcmp(cache->failed, path) != 0)
+    {
+        free(cache->failed);
+        cache->failed = NULL;
+    }
+    unsigned bucket = hash_path(path);
+    for (DirCacheEntry *entry = cache->buckets[bucket]; entry; entry = entry->chain)
+    {
+        if (strcmp(entry->listing.path, path) == 0)
+        {
+            // hit, no round trip
+            lru_unlink(cache, entry);
+            lru_push_front(cache, entry);
+            return &entry->listing;
+        }
+    }
+
+    // the error stays on screen instead of asking again on every redraw
+    if (cache->failed)
+    {
+        return NULL;
+    }
+
+    DirCacheEntry *entry = fetch_entry(cache, conn, path);
+    if (!entry) return NULL;
+
+    if (cache->count >= DIR_CACHE_CAPACITY)
+    {
+        evict_oldest(cache);
+    }
+    entry->chain = cache->buckets[bucket];
+    cache->buckets[bucket] = entry;
+    lru_push_front(cache, entry);
+    cache->count++;
+    if (entry->listing.streaming)
+    {
+        cache->streaming = entry;
+    }
+    return &entry->listing;
+}
+
+ListingState dir_cache_receive(DirCache *cache)
+{
+    DirCacheEntry *entry = cache->streaming;
+    if (!entry)
+    {
+        listing_worker_take(cache->worker, NULL, cache->error, sizeof(cache->error));
+        return LISTING_DONE;
+    }
+    ListingState state = listing_worker_take(cache->worker, &entry->listing, cache->error, sizeof(cache->error));
+    if (state == LISTING_DONE)
+    {
+        dir_listing_sort(&entry->listing);
+        entry->listing.streaming = false;
+        cache->streaming = NULL;
+    }
+    else if (state == LISTING_FAILED)
+    {
+        free(cache->failed);
+        cache->failed = strdup(entry->listing.path);
+        drop_entry(cache, entry);
+    }
+    return state;
+}
+
+bool dir_cache_sync_db_update(DirCache *cache, struct mpd_connection *conn)
+{
+    struct mpd_stats *stats = mpd_run_stats(conn);
+    if (!stats)
+    {
+        // can't tell what changed, so assume everything did
+        mpd_connection_clear_error(conn);
+        dir_cache_clear(cache);
+        return true;
+    }
+    unsigned long db_update = mpd_stats_get_db_update_time(stats);
+    mpd_stats_free(stats);
+
+    if (db_update == cache->db_update)
+    {
+        return false;
+    }
+    cache->db_update = db_update;
+    dir_cache_clear(cache);
+    return true;
+}
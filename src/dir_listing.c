@@ -0,0 +1,196 @@
+#include "../include/dir_listing.h"
+#include <ctype.h>
+#include <strings.h>
+
+// entries a fresh listing has room for before the first grow
+#define DIR_LISTING_INITIAL_CAPACITY 64
+
+bool dir_listing_init(DirListing *listing, const char *path)
+{
+    memset(listing, 0, sizeof(DirListing));
+    arena_init(&listing->strings, ARENA_BLOCK_SIZE);
+    listing->path = strdup(path);
+    return listing->path != NULL;
+}
+
+// double both arrays together so they always have the same capacity
+static bool grow(DirListing *listing)
+{
+    int capacity = listing->capacity ? listing->capacity * 2 : DIR_LISTING_INITIAL_CAPACITY;
+
+    const char **uris = realloc(listing->uris, capacity * sizeof(char*));
+    if (!uris) return false;
+    listing->uris = uris;
+
+    unsigned char *types = realloc(listing->types, capacity);
+    if (!types) return false;
+    listing->types = types;
+
+    listing->capacity = capacity;
+    return true;
+}
+
+bool dir_listing_push(DirListing *listing, const char *uri, EntryType type)
+{
+    if (listing->count == listing->capacity && !grow(listing))
+    {
+        return false;
+    }
+
+    const char *copy = arena_strdup(&listing->strings, uri);
+    if (!copy) return false;
+
+    listing->uris[listing->count] = copy;
+    listing->types[listing->count] = type;
+    listing->count++;
+    return true;
+}
+
+bool dir_listing_fetch(DirListing *listing, struct mpd_connection *conn)
+{
+    if (!mpd_send_list_meta(conn, listing->path[0] ? listing->path : NULL))
+    {
+        return false;
+    }
+
+    bool ok = true;
+    struct mpd_entity *entity;
+    while ((entity = mpd_recv_entity(conn)) != NULL)
+    {
+        // playlists are skipped, after a failed push we still drain the response
+        if (ok && mpd_entity_get_type(entity) == MPD_ENTITY_TYPE_DIRECTORY)
+        {
+            const struct mpd_directory *dir = mpd_entity_get_directory(entity);
+            ok = dir_listing_push(listing, mpd_directory_get_path(dir), ENTRY_DIRECTORY);
+        }
+        else if (ok && mpd_entity_get_type(entity) == MPD_ENTITY_TYPE_SONG)
+        {
+            const struct mpd_song *song = mpd_entity_get_song(entity);
+            ok = dir_listing_push(listing, mpd_song_get_uri(song), ENTRY_SONG);
+        }
+        mpd_entity_free(entity);
+    }
+
+    if (mpd_connection_get_error(conn) != MPD_ERROR_SUCCESS || !mpd_response_finish(conn))
+    {
+        return false;
+    }
+    if (ok)
+    {
+        dir_listing_sort(listing);
+    }
+    return ok;
+}
+
+bool dir_listing_from_library(DirListing *listing, const Library *library)
+{
+    uint32_t dir = library_find_dir(library, listing->path);
+    if (dir == LIBRARY_NONE)
+    {
+        return false;
+    }
+
+    // the library keeps children in listing order already, no sort needed
+    uint32_t first = library->dir_first_child[dir];
+    for (uint32_t i = first; i < first + library->dir_child_count[dir]; i++)
+    {
+        if (!dir_listing_push(listing, library_str(library, library->dir_path[i]), ENTRY_DIRECTORY)) return false;
+    }
+    first = library->dir_first_song[dir];
+    for (uint32_t i = first; i < first + library->dir_song_count[dir]; i++)
+    {
+        if (!dir_listing_push(listing, library_str(library, library->song_uri[i]), ENTRY_SONG)) return false;
+    }
+    return true;
+}
+
+const char *dir_listing_name(const char *uri)
+{
+    const char *slash = strrchr(uri, '/');
+    return slash ? slash + 1 : uri;
+}
+
+typedef struct
+{
+    const char *uri;
+    unsigned char type;
+} SortEntry;
+
+static int compare_entries(const void *a, const void *b)
+{
+    const SortEntry *x = a;
+    const SortEntry *y = b;
+    if (x->type != y->type) return x->type - y->type;
+    return strcasecmp(dir_listing_name(x->uri), dir_listing_name(y->uri));
+}
+
+void dir_listing_sort(DirListing *listing)
+{
+    if (listing->count < 2) return;
+
+    SortEntry *entries = malloc(listing->count * sizeof(SortEntry));
+    if (!entries) return;
+    for (int i = 0; i < listing->count; i++)
+    {
+        entries[i].uri = listing->uris[i];
+        entries[i].type = listing->types[i];
+    }
+    qsort(entries, listing->count, sizeof(SortEntry), compare_entries);
+    for (int i = 0; i < listing->count; i++)
+    {
+        listing->uris[i] = entries[i].uri;
+        listing->types[i] = entries[i].type;
+    }
+    free(entries);
+}
+
+// first index in [lo, hi) whose lowercased first letter is >= letter
+static int lower_bound_letter(const DirListing *listing, int lo, int hi, int letter)
+{
+    while (lo < hi)
+    {
+        int mid = lo + (hi - lo) / 2;
+        int first = tolower((unsigned char)dir_listing_name(listing->uris[mid])[0]);
+        if (first < letter) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+int dir_listing_find_letter(const DirListing *listing, char letter)
+{
+    int target = tolower((unsigned char)letter);
+
+    // directories come first, find where the songs start
+    int lo = 0, hi = listing->count;
+    while (lo < hi)
+    {
+        int mid = lo + (hi - lo) / 2;
+        if (listing->types[mid] == ENTRY_DIRECTORY) lo = mid + 1;
+        else hi = mid;
+    }
+    int songs = lo;
+
+    int groups[2][2] = { { 0, songs }, { songs, listing->count } };
+    for (int g = 0; g < 2; g++)
+    {
+        int i = lower_bound_letter(listing, groups[g][0], groups[g][1], target);
+        if (i < groups[g][1] && tolower((unsigned char)dir_listing_name(listing->uris[i])[0]) == target)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+void dir_listing_free(DirListing *listing)
+{
+    arena_free(&listing->strings);
+    free(listing->uris);
+    free(listing->types);
+    free(listing->path);
+    listing->uris = NULL;
+    listing->types = NULL;
+    listing->path = NULL;
+    listing->count = listing->capacity = 0;
+}
@@ -0,0 +1,191 @@
+#include "../include/downsample.h"
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define DOWNSAMPLE_X86 1
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+// row_sum[x] += row[x], the hot loop: every decoded pixel goes through here
+
+static void accumulate_scalar(uint32_t *sum, const unsigned char *row, int width)
+{
+    for (int x = 0; x < width; x++)
+    {
+        sum[x] += row[x];
+    }
+}
+
+#if defined(DOWNSAMPLE_X86)
+
+#if defined(__SSE2__)
+static void accumulate_sse2(uint32_t *sum, const unsigned char *row, int width)
+{
+    const __m128i zero = _mm_setzero_si128();
+    int x = 0;
+    for (; x + 16 <= width; x += 16)
+    {
+        __m128i pixels = _mm_loadu_si128((const __m128i *)(row + x));
+        __m128i lo16 = _mm_unpacklo_epi8(pixels, zero);
+        __m128i hi16 = _mm_unpackhi_epi8(pixels, zero);
+
+        __m128i *dst = (__m128i *)(sum + x);
+        _mm_storeu_si128(dst + 0, _mm_add_epi32(_mm_loadu_si128(dst + 0), _mm_unpacklo_epi16(lo16, zero)));
+        _mm_storeu_si128(dst + 1, _mm_add_epi32(_mm_loadu_si128(dst + 1), _mm_unpackhi_epi16(lo16, zero)));
+        _mm_storeu_si128(dst + 2, _mm_add_epi32(_mm_loadu_si128(dst + 2), _mm_unpacklo_epi16(hi16, zero)));
+        _mm_storeu_si128(dst + 3, _mm_add_epi32(_mm_loadu_si128(dst + 3), _mm_unpackhi_epi16(hi16, zero)));
+    }
+    accumulate_scalar(sum + x, row + x, width - x);
+}
+#endif
+
+__attribute__((target("avx2")))
+static void accumulate_avx2(uint32_t *sum, const unsigned char *row, int width)
+{
+    int x = 0;
+    for (; x + 16 <= width; x += 16)
+    {
+        __m256i lo = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(row + x)));
+        __m256i hi = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(row + x + 8)));
+
+        __m256i *dst = (__m256i *)(sum + x);
+        _mm256_storeu_si256(dst + 0, _mm256_add_epi32(_mm256_loadu_si256(dst + 0), lo));
+        _mm256_storeu_si256(dst + 1, _mm256_add_epi32(_mm256_loadu_si256(dst + 1), hi));
+    }
+    accumulate_scalar(sum + x, row + x, width - x);
+}
+
+#elif defined(__ARM_NEON)
+
+static void accumulate_neon(uint32_t *sum, const unsigned char *row, int width)
+{
+    int x = 0;
+    for (; x + 16 <= width; x += 16)
+    {
+        uint8x16_t pixels = vld1q_u8(row + x);
+        uint16x8_t lo16 = vmovl_u8(vget_low_u8(pixels));
+        uint16x8_t hi16 = vmovl_u8(vget_high_u8(pixels));
+
+        vst1q_u32(sum + x + 0, vaddw_u16(vld1q_u32(sum + x + 0), vget_low_u16(lo16)));
+        vst1q_u32(sum + x + 4, vaddw_u16(vld1q_u32(sum + x + 4), vget_high_u16(lo16)));
+        vst1q_u32(sum + x + 8, vaddw_u16(vld1q_u32(sum + x + 8), vget_low_u16(hi16)));
+        vst1q_u32(sum + x + 12, vaddw_u16(vld1q_u32(sum + x + 12), vget_high_u16(hi16)));
+    }
+    accumulate_scalar(sum + x, row + x, width - x);
+}
+
+#endif
+
+typedef void (*AccumulateFn)(uint32_t *sum, const unsigned char *row, int width);
+
+// best row accumulator this cpu can run
+static AccumulateFn pick_accumulate(void)
+{
+#if defined(DOWNSAMPLE_X86)
+    if (__builtin_cpu_supports("avx2")) return accumulate_avx2;
+#if defined(__SSE2__)
+    return accumulate_sse2;
+#endif
+#elif defined(__ARM_NEON)
+    return accumulate_neon;
+#endif
+    return accumulate_scalar;
+}
+
+// source range [start, end) covered by cell i of n over size pixels, never empty
+static void cell_range(int i, int n, int size, int *start, int *end)
+{
+    *start = (int)((long long)i * size / n);
+    *end = (int)((long long)(i + 1) * size / n);
+    if (*end <= *start) *end = *start + 1;
+}
+
+bool downsampler_init(Downsampler *ds, int src_width, int src_height, int cells_x, int cells_y)
+{
+    memset(ds, 0, sizeof(Downsampler));
+    if (src_width <= 0 || src_height <= 0 || cells_x <= 0 || cells_y <= 0)
+    {
+        return false;
+    }
+    ds->src_width = src_width;
+    ds->src_height = src_height;
+    ds->cells_x = cells_x;
+    ds->cells_y = cells_y;
+    ds->accumulate = pick_accumulate();
+
+    ds->col_start = malloc(cells_x * sizeof(int));
+    ds->col_end = malloc(cells_x * sizeof(int));
+    ds->row_sum = calloc(src_width, sizeof(uint32_t));
+    ds->means = calloc((size_t)cells_x * cells_y, 1);
+    if (!ds->col_start || !ds->col_end || !ds->row_sum || !ds->means)
+    {
+        downsampler_free(ds);
+        return false;
+    }
+    for (int c = 0; c < cells_x; c++)
+    {
+        cell_range(c, cells_x, src_width, &ds->col_start[c], &ds->col_end[c]);
+    }
+    return true;
+}
+
+// turn row_sum into the means of the current cell row
+static void finish_cell_row(Downsampler *ds)
+{
+    unsigned char *out = ds->means + (size_t)ds->cell_row * ds->cells_x;
+    for (int c = 0; c < ds->cells_x; c++)
+    {
+        uint32_t total = 0;
+        for (int x = ds->col_start[c]; x < ds->col_end[c]; x++)
+        {
+            total += ds->row_sum[x];
+        }
+        // divide by the cell area as a 32.32 fixed-point multiply
+        uint64_t area = (uint64_t)(ds->col_end[c] - ds->col_start[c]) * ds->rows_summed;
+        uint64_t inverse = ((1ull << 32) + area - 1) / area;
+        out[c] = (unsigned char)(((uint64_t)total * inverse) >> 32);
+    }
+}
+
+void downsampler_push_row(Downsampler *ds, const unsigned char *row)
+{
+    if (ds->cell_row >= ds->cells_y) return;
+
+    int y = ds->next_row++;
+    ds->accumulate(ds->row_sum, row, ds->src_width);
+    ds->rows_summed++;
+
+    int start, end;
+    cell_range(ds->cell_row, ds->cells_y, ds->src_height, &start, &end);
+    if (y + 1 < end) return;
+
+    finish_cell_row(ds);
+    ds->cell_row++;
+
+    // images shorter than the grid: later cell rows may map onto this same source row
+    while (ds->cell_row < ds->cells_y)
+    {
+        cell_range(ds->cell_row, ds->cells_y, ds->src_height, &start, &end);
+        if (start > y) break;
+        memcpy(ds->means + (size_t)ds->cell_row * ds->cells_x,
+               ds->means + (size_t)(ds->cell_row - 1) * ds->cells_x, ds->cells_x);
+        ds->cell_row++;
+    }
+
+    memset(ds->row_sum, 0, ds->src_width * sizeof(uint32_t));
+    ds->rows_summed = 0;
+}
+
+void downsampler_free(Downsampler *ds)
+{
+    free(ds->col_start);
+    free(ds->col_end);
+    free(ds->row_sum);
+    free(ds->means);
+    ds->col_start = ds->col_end = NULL;
+    ds->row_sum = NULL;
+    ds->means = NULL;
+}
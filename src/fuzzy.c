@@ -0,0 +1,357 @@
+#include "../include/fuzzy.h"
+#include <ctype.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+// bit for a character: letters (either case) and digits get their own, the rest share 28
+static int char_bit(unsigned char c)
+{
+    c = (unsigned char)tolower(c);
+    if (c >= 'a' && c <= 'z') return c - 'a';
+    if (c >= '0' && c <= '9') return 26 + (c - '0');
+    return 36 + c % 28;
+}
+
+static uint64_t mask_of(const char *text)
+{
+    uint64_t mask = 0;
+    for (const unsigned char *p = (const unsigned char *)text; *p; p++)
+    {
+        mask |= 1ull << char_bit(*p);
+    }
+    return mask;
+}
+
+const char *fuzzy_candidate(const FuzzyFinder *finder, uint32_t candidate, bool *is_dir)
+{
+    const Library *library = finder->library;
+    uint32_t dirs = library->dir_count - 1;
+    *is_dir = candidate < dirs;
+    return *is_dir ? library_str(library, library->dir_path[candidate + 1])
+                   : library_str(library, library->song_uri[candidate - dirs]);
+}
+
+// candidates in [start, end) whose mask holds every bit of need, written to out
+static uint32_t prefilter(const uint64_t *masks, uint32_t start, uint32_t end, uint64_t need, uint32_t *out)
+{
+    uint32_t n = 0;
+    uint32_t i = start;
+#if defined(__AVX2__)
+    __m256i want = _mm256_set1_epi64x((long long)need);
+    for (; i + 4 <= end; i += 4)
+    {
+        __m256i have = _mm256_loadu_si256((const __m256i *)(masks + i));
+        __m256i ok = _mm256_cmpeq_epi64(_mm256_and_si256(have, want), want);
+        int bits = _mm256_movemask_pd(_mm256_castsi256_pd(ok));
+        while (bits)
+        {
+            out[n++] = i + __builtin_ctz(bits);
+            bits &= bits - 1;
+        }
+    }
+#elif defined(__SSE2__)
+    __m128i want = _mm_set1_epi64x((long long)need);
+    for (; i + 2 <= end; i += 2)
+    {
+        __m128i have = _mm_loadu_si128((const __m128i *)(masks + i));
+        // no 64 bit compare before SSE4.1, both 32 bit halves of a lane have to match
+        int bits = _mm_movemask_epi8(_mm_cmpeq_epi32(_mm_and_si128(have, want), want));
+        if ((bits & 0x00ff) == 0x00ff) out[n++] = i;
+        if ((bits & 0xff00) == 0xff00) out[n++] = i + 1;
+    }
+#endif
+    for (; i < end; i++)
+    {
+        if ((masks[i] & need) == need) out[n++] = i;
+    }
+    return n;
+}
+
+static bool is_boundary(const char *text, size_t i)
+{
+    return i == 0 || text[i - 1] == '/' || text[i - 1] == ' ' || text[i - 1] == '_' ||
+           text[i - 1] == '-' || text[i - 1] == '.';
+}
+
+// fzf v1 style: leftmost match, then the shortest window ending where it ended, scored for
+// word starts, runs of matched characters and landing in the file name; false if query isn't a subsequence
+static bool score_match(const char *text, const char *query, size_t query_len, int *score)
+{
+    size_t i = 0;
+    size_t j = 0;
+    for (; text[i] && j < query_len; i++)
+    {
+        if (tolower((unsigned char)text[i]) == query[j]) j++;
+    }
+    if (j < query_len)
+    {
+        return false;
+    }
+    size_t end = i;
+    size_t start = end;
+    while (j > 0)
+    {
+        start--;
+        if (tolower((unsigned char)text[start]) == query[j - 1]) j--;
+    }
+
+    const char *slash = strrchr(text, '/');
+    size_t name = slash ? (size_t)(slash - text) + 1 : 0;
+    bool run = false;
+    *score = 0;
+    for (i = start, j = 0; i < end; i++)
+    {
+        if (j < query_len && tolower((unsigned char)text[i]) == query[j])
+        {
+            *score += 16;
+            if (is_boundary(text, i)) *score += 8;
+            if (run) *score += 6;
+            if (i >= name) *score += 2;
+            run = true;
+            j++;
+        }
+        else
+        {
+            *score -= 1;
+            run = false;
+        }
+    }
+    // shorter paths win ties
+    *score -= (int)(strlen(text + end) / 16);
+    return true;
+}
+
+static bool better(FuzzyMatch a, FuzzyMatch b)
+{
+    return a.score != b.score ? a.score > b.score : a.candidate < b.candidate;
+}
+
+// keep best sorted and at most FUZZY_MAX_RESULTS long
+static void insert_best(FuzzyMatch *best, int *count, FuzzyMatch match)
+{
+    if (*count == FUZZY_MAX_RESULTS && !better(match, best[FUZZY_MAX_RESULTS - 1]))
+    {
+        return;
+    }
+    int i = *count < FUZZY_MAX_RESULTS ? (*count)++ : FUZZY_MAX_RESULTS - 1;
+    while (i > 0 && better(match, best[i - 1]))
+    {
+        best[i] = best[i - 1];
+        i--;
+    }
+    best[i] = match;
+}
+
+// best matches among candidates [start, end), -1 once job is no longer the current query
+static int scan_block(FuzzyFinder *finder, unsigned job, const char *query, uint64_t need,
+                      uint32_t start, uint32_t end, FuzzyMatch *found)
+{
+    uint32_t survivors[FUZZY_BLOCK];
+    uint32_t count = prefilter(finder->masks, start, end, need, survivors);
+    size_t query_len = strlen(query);
+    int found_count = 0;
+    for (uint32_t i = 0; i < count; i++)
+    {
+        if ((i & 255) == 0 && atomic_load_explicit(&finder->generation, memory_order_relaxed) != job)
+        {
+            return -1;
+        }
+        bool is_dir;
+        int score;
+        if (score_match(fuzzy_candidate(finder, survivors[i], &is_dir), query, query_len, &score))
+        {
+            insert_best(found, &found_count, (FuzzyMatch){ survivors[i], score });
+        }
+    }
+    return found_count;
+}
+
+static void *worker_main(void *arg)
+{
+    FuzzyFinder *finder = arg;
+    FuzzyMatch found[FUZZY_MAX_RESULTS];
+    char query[FUZZY_QUERY_MAX];
+
+    pthread_mutex_lock(&finder->lock);
+    for (;;)
+    {
+        while (!finder->quit && (!finder->query[0] || finder->next_block >= finder->candidate_count))
+        {
+            pthread_cond_wait(&finder->wake, &finder->lock);
+        }
+        if (finder->quit)
+        {
+            break;
+        }
+        // blocks are handed out one at a time, so fast workers just take more of them
+        unsigned job = finder->job;
+        uint32_t start = finder->next_block;
+        uint32_t end = finder->candidate_count - start > FUZZY_BLOCK ? start + FUZZY_BLOCK : finder->candidate_count;
+        finder->next_block = end;
+        memcpy(query, finder->query, sizeof(query));
+        uint64_t need = finder->query_mask;
+        finder->busy++;
+        pthread_mutex_unlock(&finder->lock);
+
+        int found_count = scan_block(finder, job, query, need, start, end, found);
+
+        pthread_mutex_lock(&finder->lock);
+        finder->busy--;
+        if (found_count >= 0 && job == finder->job)
+        {
+            for (int i = 0; i < found_count; i++)
+            {
+                insert_best(finder->best, &finder->best_count, found[i]);
+            }
+            finder->scanned += end - start;
+            uint64_t one = 1;
+            if (write(finder->event_fd, &one, sizeof(one)) < 0)
+            {
+                // the counter can only overflow if the ui stopped reading, nothing to do
+            }
+        }
+        if (finder->busy == 0)
+        {
+            pthread_cond_broadcast(&finder->idle);
+        }
+    }
+    pthread_mutex_unlock(&finder->lock);
+    return NULL;
+}
+
+bool fuzzy_finder_start(FuzzyFinder *finder, const Library *library)
+{
+    memset(finder, 0, sizeof(FuzzyFinder));
+    finder->library = library;
+    finder->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (finder->event_fd < 0)
+    {
+        return false;
+    }
+    pthread_mutex_init(&finder->lock, NULL);
+    pthread_cond_init(&finder->wake, NULL);
+    pthread_cond_init(&finder->idle, NULL);
+
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int wanted = cpus < 1 ? 1 : cpus > FUZZY_MAX_THREADS ? FUZZY_MAX_THREADS : (int)cpus;
+    while (finder->thread_count < wanted &&
+           pthread_create(&finder->threads[finder->thread_count], NULL, worker_main, finder) == 0)
+    {
+        finder->thread_count++;
+    }
+    if (finder->thread_count == 0)
+    {
+        pthread_mutex_destroy(&finder->lock);
+        pthread_cond_destroy(&finder->wake);
+        pthread_cond_destroy(&finder->idle);
+        close(finder->event_fd);
+        return false;
+    }
+    return true;
+}
+
+// every candidate's character mask; only called while no job runs
+static void build_masks(FuzzyFinder *finder)
+{
+    const Library *library = finder->library;
+    uint32_t count = library->dir_count - 1 + library->song_count;
+    uint64_t *masks = malloc((size_t)(count ? count : 1) * sizeof(uint64_t));
+    if (!masks)
+    {
+        return;
+    }
+    for (uint32_t i = 0; i < count; i++)
+    {
+        bool is_dir;
+        masks[i] = mask_of(fuzzy_candidate(finder, i, &is_dir));
+    }
+    finder->masks = masks;
+    finder->candidate_count = count;
+}
+
+void fuzzy_finder_query(FuzzyFinder *finder, const char *query)
+{
+    pthread_mutex_lock(&finder->lock);
+    finder->job++;
+    atomic_store(&finder->generation, finder->job);
+    finder->query[0] = '\0';
+    finder->next_block = 0;
+    finder->scanned = 0;
+    finder->best_count = 0;
+    // masks are only ever built while no block is out, the old query's blocks are done or dropped
+    while (!finder->masks && finder->busy > 0)
+    {
+        pthread_cond_wait(&finder->idle, &finder->lock);
+    }
+    if (!finder->masks && finder->library->loaded)
+    {
+        build_masks(finder);
+    }
+    if (finder->masks)
+    {
+        size_t n = 0;
+        for (; query[n] && n < FUZZY_QUERY_MAX - 1; n++)
+        {
+            finder->query[n] = (char)tolower((unsigned char)query[n]);
+        }
+        finder->query[n] = '\0';
+        finder->query_mask = mask_of(finder->query);
+    }
+    pthread_cond_broadcast(&finder->wake);
+    pthread_mutex_unlock(&finder->lock);
+}
+
+int fuzzy_finder_results(FuzzyFinder *finder, FuzzyMatch *out, int max, uint32_t *scanned)
+{
+    uint64_t count;
+    if (read(finder->event_fd, &count, sizeof(count)) < 0)
+    {
+        // EAGAIN, nothing was merged since the last look
+    }
+    pthread_mutex_lock(&finder->lock);
+    int n = finder->best_count < max ? finder->best_count : max;
+    memcpy(out, finder->best, n * sizeof(FuzzyMatch));
+    *scanned = finder->scanned;
+    pthread_mutex_unlock(&finder->lock);
+    return n;
+}
+
+void fuzzy_finder_reset(FuzzyFinder *finder)
+{
+    pthread_mutex_lock(&finder->lock);
+    finder->job++;
+    atomic_store(&finder->generation, finder->job);
+    finder->query[0] = '\0';
+    while (finder->busy > 0)
+    {
+        pthread_cond_wait(&finder->idle, &finder->lock);
+    }
+    free(finder->masks);
+    finder->masks = NULL;
+    finder->candidate_count = 0;
+    finder->next_block = 0;
+    finder->scanned = 0;
+    finder->best_count = 0;
+    pthread_mutex_unlock(&finder->lock);
+}
+
+void fuzzy_finder_stop(FuzzyFinder *finder)
+{
+    pthread_mutex_lock(&finder->lock);
+    finder->quit = true;
+    atomic_store(&finder->generation, ++finder->job);
+    pthread_cond_broadcast(&finder->wake);
+    pthread_mutex_unlock(&finder->lock);
+    for (int i = 0; i < finder->thread_count; i++)
+    {
+        pthread_join(finder->threads[i], NULL);
+    }
+    free(finder->masks);
+    pthread_mutex_destroy(&finder->lock);
+    pthread_cond_destroy(&finder->wake);
+    pthread_cond_destroy(&finder->idle);
+    close(finder->event_fd);
+}
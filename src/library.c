@@ -0,0 +1,394 @@
+#include "../include/library.h"
+#include <strings.h>
+#include <sys/mman.h>
+
+// FNV-1a, same as the other caches
+static uint32_t hash_bytes(const char *str, size_t len)
+{
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < len; i++)
+    {
+        hash ^= (unsigned char)str[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// copy len bytes of str into the pool, LIBRARY_NONE on out of memory
+static LibStr pool_add(Library *library, const char *str, size_t len)
+{
+    if ((uint64_t)library->strings_size + len + 1 > UINT32_MAX)
+    {
+        return LIBRARY_NONE;
+    }
+    if (library->strings_size + len + 1 > library->strings_capacity)
+    {
+        uint64_t capacity = library->strings_capacity ? library->strings_capacity : 64 * 1024;
+        while (capacity < library->strings_size + len + 1) capacity *= 2;
+        if (capacity > UINT32_MAX) capacity = UINT32_MAX;
+        char *grown = realloc(library->strings, capacity);
+        if (!grown) return LIBRARY_NONE;
+        library->strings = grown;
+        library->strings_capacity = (uint32_t)capacity;
+    }
+    LibStr offset = library->strings_size;
+    memcpy(library->strings + offset, str, len);
+    library->strings[offset + len] = '\0';
+    library->strings_size += len + 1;
+    return offset;
+}
+
+// rebuild the intern set at size slots
+static bool intern_rehash(Library *library, uint32_t size)
+{
+    uint32_t *table = calloc(size, sizeof(uint32_t));
+    if (!table) return false;
+    for (uint32_t i = 0; i < library->intern_size; i++)
+    {
+        LibStr offset = library->intern[i];
+        if (!offset) continue;
+        const char *str = library->strings + offset;
+        uint32_t slot = hash_bytes(str, strlen(str)) & (size - 1);
+        while (table[slot]) slot = (slot + 1) & (size - 1);
+        table[slot] = offset;
+    }
+    free(library->intern);
+    library->intern = table;
+    library->intern_size = size;
+    return true;
+}
+
+// offset of a tag value, stored the first time it's seen; NULL and "" are offset 0
+static LibStr intern(Library *library, const char *str)
+{
+    if (!str || !*str)
+    {
+        return 0;
+    }
+    if ((library->intern_count + 1) * 2 > library->intern_size &&
+        !intern_rehash(library, library->intern_size ? library->intern_size * 2 : 4096))
+    {
+        return LIBRARY_NONE;
+    }
+    size_t len = strlen(str);
+    uint32_t mask = library->intern_size - 1;
+    for (uint32_t slot = hash_bytes(str, len) & mask;; slot = (slot + 1) & mask)
+    {
+        LibStr offset = library->intern[slot];
+        if (!offset)
+        {
+            offset = pool_add(library, str, len);
+            if (offset == LIBRARY_NONE) return LIBRARY_NONE;
+            library->intern[slot] = offset;
+            library->intern_count++;
+            return offset;
+        }
+        if (strcmp(library->strings + offset, str) == 0)
+        {
+            return offset;
+        }
+    }
+}
+
+// grow every array in arrays to capacity elements
+static bool grow_arrays(uint32_t **arrays[], int count, uint32_t capacity)
+{
+    for (int i = 0; i < count; i++)
+    {
+        uint32_t *grown = realloc(*arrays[i], (size_t)capacity * sizeof(uint32_t));
+        if (!grown) return false;
+        *arrays[i] = grown;
+    }
+    return true;
+}
+
+static bool push_dir(Library *library, const char *path)
+{
+    if (library->dir_count == library->dir_capacity)
+    {
+        uint32_t capacity = library->dir_capacity ? library->dir_capacity * 2 : 256;
+        uint32_t **arrays[] = { &library->dir_path, &library->dir_parent, &library->dir_first_child,
+                                &library->dir_child_count, &library->dir_first_song, &library->dir_song_count };
+        if (!grow_arrays(arrays, 6, capacity)) return false;
+        library->dir_capacity = capacity;
+    }
+    LibStr offset = pool_add(library, path, strlen(path));
+    if (offset == LIBRARY_NONE) return false;
+    library->dir_path[library->dir_count++] = offset;
+    return true;
+}
+
+static bool push_song(Library *library, const struct mpd_song *song)
+{
+    if (library->song_count == library->song_capacity)
+    {
+        uint32_t capacity = library->song_capacity ? library->song_capacity * 2 : 1024;
+        uint32_t **arrays[] = { &library->song_uri, &library->song_title, &library->song_artist,
+                                &library->song_album, &library->song_date, &library->song_duration, &library->song_dir };
+        if (!grow_arrays(arrays, 7, capacity)) return false;
+        library->song_capacity = capacity;
+    }
+    uint32_t i = library->song_count;
+    const char *uri = mpd_song_get_uri(song);
+    library->song_uri[i] = pool_add(library, uri, strlen(uri));
+    library->song_title[i] = intern(library, mpd_song_get_tag(song, MPD_TAG_TITLE, 0));
+    library->song_artist[i] = intern(library, mpd_song_get_tag(song, MPD_TAG_ARTIST, 0));
+    library->song_album[i] = intern(library, mpd_song_get_tag(song, MPD_TAG_ALBUM, 0));
+    library->song_date[i] = intern(library, mpd_song_get_tag(song, MPD_TAG_DATE, 0));
+    library->song_duration[i] = mpd_song_get_duration(song);
+    if (library->song_uri[i] == LIBRARY_NONE || library->song_title[i] == LIBRARY_NONE ||
+        library->song_artist[i] == LIBRARY_NONE || library->song_album[i] == LIBRARY_NONE ||
+        library->song_date[i] == LIBRARY_NONE)
+    {
+        return false;
+    }
+    library->song_count++;
+    return true;
+}
+
+// length of the parent part of path ("a/b/c" -> 3), 0 for top level entries
+static size_t parent_length(const char *path)
+{
+    const char *slash = strrchr(path, '/');
+    return slash ? (size_t)(slash - path) : 0;
+}
+
+static const char *base_name(const char *path)
+{
+    const char *slash = strrchr(path, '/');
+    return slash ? slash + 1 : path;
+}
+
+static uint32_t find_dir(const Library *library, const char *path, size_t len)
+{
+    if (!library->dir_table_size)
+    {
+        return LIBRARY_NONE;
+    }
+    uint32_t mask = library->dir_table_size - 1;
+    for (uint32_t slot = hash_bytes(path, len) & mask;; slot = (slot + 1) & mask)
+    {
+        uint32_t entry = library->dir_table[slot];
+        if (!entry)
+        {
+            return LIBRARY_NONE;
+        }
+        const char *candidate = library->strings + library->dir_path[entry - 1];
+        if (strncmp(candidate, path, len) == 0 && candidate[len] == '\0')
+        {
+            return entry - 1;
+        }
+    }
+}
+
+typedef struct
+{
+    const char *path;
+    uint32_t dir;
+    uint32_t index;
+} SortEntry;
+
+// siblings next to each other (same parent path), then by name like lsinfo listings
+static int compare_dirs(const void *a, const void *b)
+{
+    const char *x = ((const SortEntry *)a)->path;
+    const char *y = ((const SortEntry *)b)->path;
+    size_t x_len = parent_length(x);
+    size_t y_len = parent_length(y);
+    int cmp = memcmp(x, y, x_len < y_len ? x_len : y_len);
+    if (cmp) return cmp;
+    if (x_len != y_len) return x_len < y_len ? -1 : 1;
+    cmp = strcasecmp(base_name(x), base_name(y));
+    return cmp ? cmp : strcmp(x, y);
+}
+
+static int compare_songs(const void *a, const void *b)
+{
+    const SortEntry *x = a;
+    const SortEntry *y = b;
+    if (x->dir != y->dir) return x->dir < y->dir ? -1 : 1;
+    int cmp = strcasecmp(base_name(x->path), base_name(y->path));
+    return cmp ? cmp : (x->index > y->index) - (x->index < y->index);
+}
+
+// reorder array by order[].index
+static bool permute(uint32_t **array, const SortEntry *order, uint32_t count)
+{
+    uint32_t *sorted = malloc((size_t)count * sizeof(uint32_t));
+    if (!sorted) return false;
+    for (uint32_t i = 0; i < count; i++)
+    {
+        sorted[i] = (*array)[order[i].index];
+    }
+    free(*array);
+    *array = sorted;
+    return true;
+}
+
+// sort directories and songs so children are contiguous, then fill in parents and slices
+static bool link_tree(Library *library)
+{
+    uint32_t dirs = library->dir_count;
+    uint32_t songs = library->song_count;
+    uint32_t entries = dirs > songs ? dirs : songs;
+    SortEntry *order = malloc((size_t)(entries ? entries : 1) * sizeof(SortEntry));
+    if (!order) return false;
+
+    // the root stays at index 0, everything else sorted by parent then name
+    for (uint32_t i = 1; i < dirs; i++)
+    {
+        order[i - 1].path = library->strings + library->dir_path[i];
+    }
+    qsort(order, dirs - 1, sizeof(SortEntry), compare_dirs);
+    for (uint32_t i = 1; i < dirs; i++)
+    {
+        library->dir_path[i] = (LibStr)(order[i - 1].path - library->strings);
+    }
+
+    uint32_t size = 64;
+    while (size < dirs * 2) size *= 2;
+    free(library->dir_table);
+    library->dir_table = calloc(size, sizeof(uint32_t));
+    if (!library->dir_table)
+    {
+        free(order);
+        return false;
+    }
+    library->dir_table_size = size;
+    for (uint32_t i = 0; i < dirs; i++)
+    {
+        const char *path = library->strings + library->dir_path[i];
+        uint32_t slot = hash_bytes(path, strlen(path)) & (size - 1);
+        while (library->dir_table[slot]) slot = (slot + 1) & (size - 1);
+        library->dir_table[slot] = i + 1;
+        library->dir_child_count[i] = 0;
+        library->dir_song_count[i] = 0;
+        library->dir_first_child[i] = 0;
+        library->dir_first_song[i] = 0;
+    }
+
+    library->dir_parent[LIBRARY_ROOT] = LIBRARY_NONE;
+    for (uint32_t i = 1; i < dirs; i++)
+    {
+        const char *path = library->strings + library->dir_path[i];
+        uint32_t parent = find_dir(library, path, parent_length(path));
+        library->dir_parent[i] = parent;
+        if (parent == LIBRARY_NONE) continue;
+        if (library->dir_child_count[parent]++ == 0) library->dir_first_child[parent] = i;
+    }
+
+    // songs by directory, then name
+    for (uint32_t i = 0; i < songs; i++)
+    {
+        const char *uri = library->strings + library->song_uri[i];
+        order[i].path = uri;
+        order[i].dir = find_dir(library, uri, parent_length(uri));
+        order[i].index = i;
+    }
+    qsort(order, songs, sizeof(SortEntry), compare_songs);
+    uint32_t **arrays[] = { &library->song_uri, &library->song_title, &library->song_artist,
+                            &library->song_album, &library->song_date, &library->song_duration };
+    for (int a = 0; a < 6; a++)
+    {
+        if (!permute(arrays[a], order, songs))
+        {
+            free(order);
+            return false;
+        }
+    }
+    for (uint32_t i = 0; i < songs; i++)
+    {
+        uint32_t dir = order[i].dir;
+        library->song_dir[i] = dir;
+        if (dir == LIBRARY_NONE) continue;
+        if (library->dir_song_count[dir]++ == 0) library->dir_first_song[dir] = i;
+    }
+    // permute() hands back exactly sized arrays
+    library->song_capacity = songs;
+    free(order);
+    return true;
+}
+
+void library_init(Library *library)
+{
+    memset(library, 0, sizeof(Library));
+}
+
+bool library_load(Library *library, struct mpd_connection *conn, unsigned long db_update)
+{
+    Library fresh;
+    library_init(&fresh);
+    if (pool_add(&fresh, "", 0) == LIBRARY_NONE || !push_dir(&fresh, ""))
+    {
+        library_free(&fresh);
+        return false;
+    }
+    if (!mpd_send_list_all_meta(conn, NULL))
+    {
+        library_free(&fresh);
+        return false;
+    }
+
+    // playlists are skipped, after a failed push we still drain the response
+    bool ok = true;
+    struct mpd_entity *entity;
+    while ((entity = mpd_recv_entity(conn)) != NULL)
+    {
+        if (ok && mpd_entity_get_type(entity) == MPD_ENTITY_TYPE_DIRECTORY)
+        {
+            ok = push_dir(&fresh, mpd_directory_get_path(mpd_entity_get_directory(entity)));
+        }
+        else if (ok && mpd_entity_get_type(entity) == MPD_ENTITY_TYPE_SONG)
+        {
+            ok = push_song(&fresh, mpd_entity_get_song(entity));
+        }
+        mpd_entity_free(entity);
+    }
+    if (mpd_connection_get_error(conn) != MPD_ERROR_SUCCESS || !mpd_response_finish(conn))
+    {
+        ok = false;
+    }
+    if (!ok || !link_tree(&fresh))
+    {
+        library_free(&fresh);
+        return false;
+    }
+
+    fresh.db_update = db_update;
+    fresh.loaded = true;
+    library_free(library);
+    *library = fresh;
+    return true;
+}
+
+const char *library_str(const Library *library, LibStr str)
+{
+    return library->strings + str;
+}
+
+uint32_t library_find_dir(const Library *library, const char *path)
+{
+    return library->loaded ? find_dir(library, path, strlen(path)) : LIBRARY_NONE;
+}
+
+void library_free(Library *library)
+{
+    if (library->map)
+    {
+        munmap(library->map, library->map_size);
+        library_init(library);
+        return;
+    }
+    uint32_t **arrays[] = { &library->song_uri, &library->song_title, &library->song_artist,
+                            &library->song_album, &library->song_date, &library->song_duration,
+                            &library->song_dir, &library->dir_path, &library->dir_parent,
+                            &library->dir_first_child, &library->dir_child_count,
+                            &library->dir_first_song, &library->dir_song_count,
+                            &library->dir_table, &library->intern };
+    for (size_t i = 0; i < sizeof(arrays) / sizeof(arrays[0]); i++)
+    {
+        free(*arrays[i]);
+    }
+    free(library->strings);
+    library_init(library);
+}
@@ -0,0 +1,302 @@
+#include "../include/library_snapshot.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define SECTION_ALIGN 8
+
+static uint64_t align_up(uint64_t offset)
+{
+    return (offset + SECTION_ALIGN - 1) & ~(uint64_t)(SECTION_ALIGN - 1);
+}
+
+// the uint32_t arrays of library in file order (sections 1..), with their lengths
+static void snapshot_arrays(Library *library, uint32_t **arrays[], uint64_t counts[])
+{
+    uint32_t **fields[LIBRARY_SNAPSHOT_SECTIONS - 1] = {
+        &library->song_uri, &library->song_title, &library->song_artist, &library->song_album,
+        &library->song_date, &library->song_duration, &library->song_dir,
+        &library->dir_path, &library->dir_parent, &library->dir_first_child, &library->dir_child_count,
+        &library->dir_first_song, &library->dir_song_count, &library->dir_table };
+    for (int i = 0; i < LIBRARY_SNAPSHOT_SECTIONS - 1; i++)
+    {
+        arrays[i] = fields[i];
+        counts[i] = i < 7 ? library->song_count : i < 13 ? library->dir_count : library->dir_table_size;
+    }
+}
+
+void library_snapshot_server(const Config *config, char *server, size_t size)
+{
+    if (strcmp(config->connection_type, "network") == 0)
+    {
+        snprintf(server, size, "%s:%d", config->host, config->port);
+    }
+    else
+    {
+        snprintf(server, size, "%s", config->socket_path);
+    }
+}
+
+// mkdir -p for the directory part of path
+static void make_parents(char *path)
+{
+    for (char *p = path + 1; *p; p++)
+    {
+        if (*p != '/') continue;
+        *p = '\0';
+        mkdir(path, 0755);
+        *p = '/';
+    }
+}
+
+char *library_snapshot_path(const char *server)
+{
+    // one file per server, FNV-1a of the address keeps the name short
+    uint32_t hash = 2166136261u;
+    for (const unsigned char *p = (const unsigned char *)server; *p; p++)
+    {
+        hash ^= *p;
+        hash *= 16777619u;
+    }
+
+    const char *cache = getenv("XDG_CACHE_HOME");
+    const char *home = getenv("HOME");
+    char path[4096];
+    if (cache && cache[0] == '/')
+    {
+        snprintf(path, sizeof(path), "%s/orpheus/library-%08x.snap", cache, hash);
+    }
+    else if (home)
+    {
+        snprintf(path, sizeof(path), "%s/.cache/orpheus/library-%08x.snap", home, hash);
+    }
+    else
+    {
+        return NULL;
+    }
+    make_parents(path);
+    return strdup(path);
+}
+
+static bool check_header(const LibrarySnapshotHeader *header, size_t file_size, const char *server)
+{
+    if (memcmp(header->magic, LIBRARY_SNAPSHOT_MAGIC, 8) != 0 ||
+        header->version != LIBRARY_SNAPSHOT_VERSION ||
+        header->header_size != sizeof(LibrarySnapshotHeader) ||
+        header->file_size != file_size ||
+        memchr(header->server, '\0', LIBRARY_SNAPSHOT_SERVER_MAX) == NULL ||
+        strcmp(header->server, server) != 0)
+    {
+        return false;
+    }
+    // the root directory and "" are always there, and lookups need an empty table slot
+    uint32_t table_size = header->dir_table_size;
+    return header->strings_size > 0 && header->dir_count > 0 &&
+           table_size > header->dir_count && (table_size & (table_size - 1)) == 0;
+}
+
+// point library's arrays into the mapping, false if a section doesn't fit the file
+static bool attach(Library *library, unsigned char *map, const LibrarySnapshotHeader *header)
+{
+    library->strings_size = library->strings_capacity = header->strings_size;
+    library->song_count = library->song_capacity = header->song_count;
+    library->dir_count = library->dir_capacity = header->dir_count;
+    library->dir_table_size = header->dir_table_size;
+
+    uint32_t **arrays[LIBRARY_SNAPSHOT_SECTIONS - 1];
+    uint64_t counts[LIBRARY_SNAPSHOT_SECTIONS - 1];
+    snapshot_arrays(library, arrays, counts);
+    for (int i = 0; i < LIBRARY_SNAPSHOT_SECTIONS; i++)
+    {
+        uint64_t offset = header->sections[i];
+        uint64_t bytes = i == 0 ? header->strings_size : counts[i - 1] * sizeof(uint32_t);
+        if (offset < sizeof(LibrarySnapshotHeader) || offset % SECTION_ALIGN != 0 ||
+            offset > header->file_size || bytes > header->file_size - offset)
+        {
+            return false;
+        }
+        if (i == 0) library->strings = (char *)map + offset;
+        else *arrays[i - 1] = (uint32_t *)(map + offset);
+    }
+    return library->strings[library->strings_size - 1] == '\0';
+}
+
+static bool all_below(const uint32_t *values, uint32_t count, uint32_t limit, bool none_ok)
+{
+    for (uint32_t i = 0; i < count; i++)
+    {
+        if (values[i] >= limit && !(none_ok && values[i] == LIBRARY_NONE)) return false;
+    }
+    return true;
+}
+
+// every directory exactly once and nothing else, so the table keeps the empty slots a missed lookup stops at
+static bool check_dir_table(const Library *library)
+{
+    uint32_t dirs = library->dir_count;
+    unsigned char *seen = calloc(dirs, 1);
+    if (!seen) return false;
+    uint32_t used = 0;
+    bool ok = true;
+    for (uint32_t i = 0; ok && i < library->dir_table_size; i++)
+    {
+        uint32_t value = library->dir_table[i];
+        if (value == 0) continue;
+        // slots hold index + 1
+        ok = value <= dirs && !seen[value - 1];
+        if (ok) seen[value - 1] = 1;
+        used++;
+    }
+    free(seen);
+    return ok && used == dirs;
+}
+
+// one linear pass so a damaged file can't send lookups outside the mapping
+static bool check_indices(const Library *library)
+{
+    uint32_t songs = library->song_count;
+    uint32_t dirs = library->dir_count;
+    const uint32_t *strings[] = { library->song_uri, library->song_title, library->song_artist,
+                                  library->song_album, library->song_date };
+    for (int i = 0; i < 5; i++)
+    {
+        if (!all_below(strings[i], songs, library->strings_size, false)) return false;
+    }
+    if (!all_below(library->dir_path, dirs, library->strings_size, false) ||
+        !all_below(library->song_dir, songs, dirs, true) ||
+        !all_below(library->dir_parent, dirs, dirs, true) ||
+        !check_dir_table(library))
+    {
+        return false;
+    }
+    for (uint32_t i = 0; i < dirs; i++)
+    {
+        if ((uint64_t)library->dir_first_child[i] + library->dir_child_count[i] > dirs ||
+            (uint64_t)library->dir_first_song[i] + library->dir_song_count[i] > songs)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool library_snapshot_open(Library *library, const char *path, const char *server)
+{
+    if (!path)
+    {
+        return false;
+    }
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(LibrarySnapshotHeader))
+    {
+        close(fd);
+        return false;
+    }
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+    {
+        return false;
+    }
+
+    // the arrays are used in place, nothing is parsed or copied
+    const LibrarySnapshotHeader *header = map;
+    Library mapped;
+    library_init(&mapped);
+    if (!check_header(header, st.st_size, server) || !attach(&mapped, map, header) || !check_indices(&mapped))
+    {
+        munmap(map, st.st_size);
+        return false;
+    }
+    mapped.db_update = header->db_update;
+    mapped.loaded = true;
+    mapped.map = map;
+    mapped.map_size = st.st_size;
+    library_free(library);
+    *library = mapped;
+    return true;
+}
+
+static bool write_all(int fd, const void *data, uint64_t size, uint64_t offset)
+{
+    const char *p = data;
+    while (size > 0)
+    {
+        ssize_t written = pwrite(fd, p, size, (off_t)offset);
+        if (written <= 0) return false;
+        p += written;
+        offset += written;
+        size -= written;
+    }
+    return true;
+}
+
+bool library_snapshot_save(const Library *library, const char *path, const char *server)
+{
+    if (!path || !library->loaded)
+    {
+        return false;
+    }
+    // a copy only to collect the array pointers, nothing in it is written to
+    Library view = *library;
+    uint32_t **arrays[LIBRARY_SNAPSHOT_SECTIONS - 1];
+    uint64_t counts[LIBRARY_SNAPSHOT_SECTIONS - 1];
+    snapshot_arrays(&view, arrays, counts);
+
+    LibrarySnapshotHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, LIBRARY_SNAPSHOT_MAGIC, 8);
+    header.version = LIBRARY_SNAPSHOT_VERSION;
+    header.header_size = sizeof(LibrarySnapshotHeader);
+    snprintf(header.server, sizeof(header.server), "%s", server);
+    header.db_update = library->db_update;
+    header.strings_size = library->strings_size;
+    header.song_count = library->song_count;
+    header.dir_count = library->dir_count;
+    header.dir_table_size = library->dir_table_size;
+    uint64_t offset = align_up(sizeof(header));
+    header.sections[0] = offset;
+    offset = align_up(offset + library->strings_size);
+    for (int i = 1; i < LIBRARY_SNAPSHOT_SECTIONS; i++)
+    {
+        header.sections[i] = offset;
+        offset = align_up(offset + counts[i - 1] * sizeof(uint32_t));
+    }
+    header.file_size = offset;
+
+    size_t tmp_len = strlen(path) + 5;
+    char *tmp = malloc(tmp_len);
+    if (!tmp)
+    {
+        return false;
+    }
+    snprintf(tmp, tmp_len, "%s.tmp", path);
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
+    {
+        free(tmp);
+        return false;
+    }
+    bool ok = write_all(fd, library->strings, library->strings_size, header.sections[0]);
+    for (int i = 1; ok && i < LIBRARY_SNAPSHOT_SECTIONS; i++)
+    {
+        ok = write_all(fd, *arrays[i - 1], counts[i - 1] * sizeof(uint32_t), header.sections[i]);
+    }
+    // header last, padding at the end comes from the truncate
+    ok = ok && ftruncate(fd, (off_t)header.file_size) == 0 && write_all(fd, &header, sizeof(header), 0);
+    ok = close(fd) == 0 && ok;
+    ok = ok && rename(tmp, path) == 0;
+    if (!ok)
+    {
+        unlink(tmp);
+    }
+    free(tmp);
+    return ok;
+}
@@ -0,0 +1,157 @@
+#include "../include/library_worker.h"
+#include "../include/mpd_connections.h"
+#include <stdint.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// one listallinfo on a connection of its own, dropped again afterwards since loads are rare
+static bool load(LibraryWorker *worker, Library *fresh, unsigned long db_update)
+{
+    struct mpd_connection *conn = open_connection(worker->config);
+    if (!conn || mpd_connection_get_error(conn) != MPD_ERROR_SUCCESS)
+    {
+        if (conn) mpd_connection_free(conn);
+        return false;
+    }
+
+    // published so stop() can shut the socket down under a long transfer
+    pthread_mutex_lock(&worker->lock);
+    bool quit = worker->quit;
+    if (!quit) worker->conn = conn;
+    pthread_mutex_unlock(&worker->lock);
+
+    bool ok = !quit && library_load(fresh, conn, db_update);
+
+    pthread_mutex_lock(&worker->lock);
+    worker->conn = NULL;
+    pthread_mutex_unlock(&worker->lock);
+    mpd_connection_free(conn);
+    return ok;
+}
+
+static void *worker_main(void *arg)
+{
+    LibraryWorker *worker = arg;
+
+    for (;;)
+    {
+        pthread_mutex_lock(&worker->lock);
+        while (!worker->pending && !worker->quit)
+        {
+            pthread_cond_wait(&worker->wake, &worker->lock);
+        }
+        if (worker->quit)
+        {
+            pthread_mutex_unlock(&worker->lock);
+            break;
+        }
+        unsigned long db_update = worker->db_update;
+        worker->pending = false;
+        pthread_mutex_unlock(&worker->lock);
+
+        Library fresh;
+        library_init(&fresh);
+        if (!load(worker, &fresh, db_update))
+        {
+            library_free(&fresh);
+            continue;
+        }
+        // saved before handing it over, the ui may free it any time after
+        library_snapshot_save(&fresh, worker->snapshot_path, worker->server);
+
+        pthread_mutex_lock(&worker->lock);
+        library_free(&worker->result);
+        worker->result = fresh;
+        worker->ready = true;
+        pthread_mutex_unlock(&worker->lock);
+
+        uint64_t one = 1;
+        if (write(worker->event_fd, &one, sizeof(one)) < 0)
+        {
+            // the counter can only overflow if the ui stopped reading, nothing to do
+        }
+    }
+    return NULL;
+}
+
+bool library_worker_start(LibraryWorker *worker, const Config *config)
+{
+    memset(worker, 0, sizeof(LibraryWorker));
+    worker->config = config;
+    library_init(&worker->result);
+    library_snapshot_server(config, worker->server, sizeof(worker->server));
+    worker->snapshot_path = library_snapshot_path(worker->server);
+
+    worker->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (worker->event_fd < 0)
+    {
+        free(worker->snapshot_path);
+        return false;
+    }
+    pthread_mutex_init(&worker->lock, NULL);
+    pthread_cond_init(&worker->wake, NULL);
+    if (pthread_create(&worker->thread, NULL, worker_main, worker) != 0)
+    {
+        pthread_mutex_destroy(&worker->lock);
+        pthread_cond_destroy(&worker->wake);
+        close(worker->event_fd);
+        free(worker->snapshot_path);
+        return false;
+    }
+    return true;
+}
+
+bool library_worker_open_snapshot(LibraryWorker *worker, Library *library)
+{
+    return library_snapshot_open(library, worker->snapshot_path, worker->server);
+}
+
+void library_worker_request(LibraryWorker *worker, unsigned long db_update)
+{
+    pthread_mutex_lock(&worker->lock);
+    worker->db_update = db_update;
+    worker->pending = true;
+    pthread_cond_signal(&worker->wake);
+    pthread_mutex_unlock(&worker->lock);
+}
+
+bool library_worker_take(LibraryWorker *worker, Library *library)
+{
+    uint64_t count;
+    if (read(worker->event_fd, &count, sizeof(count)) < 0)
+    {
+        // EAGAIN, nothing was posted since the last take
+    }
+    pthread_mutex_lock(&worker->lock);
+    bool ready = worker->ready;
+    if (ready)
+    {
+        library_free(library);
+        *library = worker->result;
+        library_init(&worker->result);
+        worker->ready = false;
+    }
+    pthread_mutex_unlock(&worker->lock);
+    return ready;
+}
+
+void library_worker_stop(LibraryWorker *worker)
+{
+    pthread_mutex_lock(&worker->lock);
+    worker->quit = true;
+    // a listallinfo in progress fails right away instead of running to the end
+    if (worker->conn)
+    {
+        shutdown(mpd_connection_get_fd(worker->conn), SHUT_RDWR);
+    }
+    pthread_cond_signal(&worker->wake);
+    pthread_mutex_unlock(&worker->lock);
+    pthread_join(worker->thread, NULL);
+
+    library_free(&worker->result);
+    pthread_mutex_destroy(&worker->lock);
+    pthread_cond_destroy(&worker->wake);
+    close(worker->event_fd);
+    free(worker->snapshot_path);
+}
@@ -0,0 +1,315 @@
+#include "../include/listing_worker.h"
+#include "../include/mpd_connections.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// (re)connect if we never did or the last listing broke the connection
+static bool ensure_connection(ListingWorker *worker)
+{
+    if (worker->conn && mpd_connection_get_error(worker->conn) == MPD_ERROR_SUCCESS)
+    {
+        return true;
+    }
+    if (worker->conn) mpd_connection_free(worker->conn);
+    worker->conn = open_connection(worker->config);
+    if (worker->conn && mpd_connection_get_error(worker->conn) == MPD_ERROR_SUCCESS)
+    {
+        return true;
+    }
+    if (worker->conn) mpd_connection_free(worker->conn);
+    worker->conn = NULL;
+    return false;
+}
+
+static void poke(ListingWorker *worker)
+{
+    uint64_t one = 1;
+    if (write(worker->event_fd, &one, sizeof(one)) < 0)
+    {
+        // the counter can only overflow if the ui stopped reading, nothing to do
+    }
+}
+
+// append to the entries waiting for the ui, under lock
+static bool push(ListingWorker *worker, const char *uri, EntryType type)
+{
+    if (worker->count == worker->capacity)
+    {
+        int capacity = worker->capacity ? worker->capacity * 2 : LISTING_FIRST_BATCH;
+        char **uris = realloc(worker->uris, capacity * sizeof(char *));
+        if (!uris) return false;
+        worker->uris = uris;
+        unsigned char *types = realloc(worker->types, capacity);
+        if (!types) return false;
+        worker->types = types;
+        worker->capacity = capacity;
+    }
+    char *copy = strdup(uri);
+    if (!copy) return false;
+    worker->uris[worker->count] = copy;
+    worker->types[worker->count] = type;
+    worker->count++;
+    return true;
+}
+
+// drop what the ui didn't take, under lock
+static void drop_entries(ListingWorker *worker)
+{
+    for (int i = 0; i < worker->count; i++)
+    {
+        free(worker->uris[i]);
+    }
+    worker->count = 0;
+}
+
+// abandon the current request, under lock
+static void cancel_locked(ListingWorker *worker)
+{
+    worker->request++;
+    if (worker->streaming)
+    {
+        // the lsinfo fails right away instead of running to the end
+        shutdown(mpd_connection_get_fd(worker->conn), SHUT_RDWR);
+        worker->streaming = false;
+        worker->broken = true;
+    }
+    drop_entries(worker);
+    free(worker->path);
+    worker->path = NULL;
+    worker->pending = false;
+    worker->state = LISTING_DONE;
+}
+
+// lsinfo path, handing entries over as they arrive; false with error set if mpd failed,
+// *pushed tells whether anything was handed over and *lost whether it failed on a dropped connection
+static bool stream_once(ListingWorker *worker, unsigned request, const char *path, char *error, size_t error_size,
+                        bool *pushed, bool *lost)
+{
+    if (!ensure_connection(worker))
+    {
+        snprintf(error, error_size, "can't connect to mpd");
+        return false;
+    }
+    pthread_mutex_lock(&worker->lock);
+    bool current = request == worker->request;
+    worker->streaming = current;
+    pthread_mutex_unlock(&worker->lock);
+    if (!current)
+    {
+        return true;
+    }
+
+    struct mpd_connection *conn = worker->conn;
+    bool sent = mpd_send_list_meta(conn, path[0] ? path : NULL);
+    bool ok = sent;
+    int batch = LISTING_FIRST_BATCH;
+    int unannounced = 0;
+    struct mpd_entity *entity;
+    while (ok && current && (entity = mpd_recv_entity(conn)) != NULL)
+    {
+        // playlists are skipped
+        const char *uri = NULL;
+        EntryType type = ENTRY_SONG;
+        if (mpd_entity_get_type(entity) == MPD_ENTITY_TYPE_DIRECTORY)
+        {
+            uri = mpd_directory_get_path(mpd_entity_get_directory(entity));
+            type = ENTRY_DIRECTORY;
+        }
+        else if (mpd_entity_get_type(entity) == MPD_ENTITY_TYPE_SONG)
+        {
+            uri = mpd_song_get_uri(mpd_entity_get_song(entity));
+        }
+        if (uri)
+        {
+            pthread_mutex_lock(&worker->lock);
+            current = request == worker->request;
+            if (current && !push(worker, uri, type))
+            {
+                snprintf(error, error_size, "out of memory");
+                ok = false;
+            }
+            pthread_mutex_unlock(&worker->lock);
+            *pushed = true;
+            // the first screenful goes out right away, later batches grow so a huge folder costs few redraws
+            if (++unannounced >= batch)
+            {
+                poke(worker);
+                unannounced = 0;
+                batch = batch * 2 > LISTING_MAX_BATCH ? LISTING_MAX_BATCH : batch * 2;
+            }
+        }
+        mpd_entity_free(entity);
+    }
+    if (current && (!sent || (ok && (mpd_connection_get_error(conn) != MPD_ERROR_SUCCESS || !mpd_response_finish(conn)))))
+    {
+        snprintf(error, error_size, "%s", mpd_connection_get_error_message(conn));
+        ok = false;
+    }
+    *lost = !ok && current && connection_lost(conn);
+
+    pthread_mutex_lock(&worker->lock);
+    worker->streaming = false;
+    // a shut down socket, or a response we stopped reading halfway, can't be reused
+    bool reconnect = worker->broken || !ok || !current;
+    worker->broken = false;
+    pthread_mutex_unlock(&worker->lock);
+    if (reconnect)
+    {
+        mpd_connection_free(conn);
+        worker->conn = NULL;
+    }
+    return ok;
+}
+
+static bool stream(ListingWorker *worker, unsigned request, const char *path, char *error, size_t error_size)
+{
+    bool pushed = false;
+    bool lost = false;
+    bool ok = stream_once(worker, request, path, error, error_size, &pushed, &lost);
+    // mpd closes a connection that was quiet for its connection_timeout, so the first lsinfo after
+    // browsing cached folders for a while finds it gone; nothing was shown yet, ask again on a new one
+    if (!ok && lost && !pushed)
+    {
+        ok = stream_once(worker, request, path, error, error_size, &pushed, &lost);
+    }
+    return ok;
+}
+
+static void *worker_main(void *arg)
+{
+    ListingWorker *worker = arg;
+
+    for (;;)
+    {
+        pthread_mutex_lock(&worker->lock);
+        while (!worker->pending && !worker->quit)
+        {
+            pthread_cond_wait(&worker->wake, &worker->lock);
+        }
+        if (worker->quit)
+        {
+            pthread_mutex_unlock(&worker->lock);
+            break;
+        }
+        unsigned request = worker->request;
+        char *path = strdup(worker->path);
+        worker->pending = false;
+        pthread_mutex_unlock(&worker->lock);
+
+        char error[96] = "out of memory";
+        bool ok = path && stream(worker, request, path, error, sizeof(error));
+        free(path);
+
+        pthread_mutex_lock(&worker->lock);
+        bool current = request == worker->request;
+        if (current)
+        {
+            worker->state = ok ? LISTING_DONE : LISTING_FAILED;
+            snprintf(worker->error, sizeof(worker->error), "%s", ok ? "" : error);
+        }
+        pthread_mutex_unlock(&worker->lock);
+        if (current)
+        {
+            poke(worker);
+        }
+    }
+    if (worker->conn) mpd_connection_free(worker->conn);
+    return NULL;
+}
+
+bool listing_worker_start(ListingWorker *worker, const Config *config)
+{
+    memset(worker, 0, sizeof(ListingWorker));
+    worker->config = config;
+    worker->state = LISTING_DONE;
+
+    worker->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (worker->event_fd < 0)
+    {
+        return false;
+    }
+    pthread_mutex_init(&worker->lock, NULL);
+    pthread_cond_init(&worker->wake, NULL);
+    if (pthread_create(&worker->thread, NULL, worker_main, worker) != 0)
+    {
+        pthread_mutex_destroy(&worker->lock);
+        pthread_cond_destroy(&worker->wake);
+        close(worker->event_fd);
+        return false;
+    }
+    return true;
+}
+
+void listing_worker_request(ListingWorker *worker, const char *path)
+{
+    pthread_mutex_lock(&worker->lock);
+    cancel_locked(worker);
+    worker->path = strdup(path);
+    bool queued = worker->path != NULL;
+    if (queued)
+    {
+        worker->pending = true;
+        worker->state = LISTING_STREAMING;
+        pthread_cond_signal(&worker->wake);
+    }
+    else
+    {
+        worker->state = LISTING_FAILED;
+        snprintf(worker->error, sizeof(worker->error), "out of memory");
+    }
+    pthread_mutex_unlock(&worker->lock);
+    if (!queued)
+    {
+        poke(worker);
+    }
+}
+
+void listing_worker_cancel(ListingWorker *worker)
+{
+    pthread_mutex_lock(&worker->lock);
+    cancel_locked(worker);
+    pthread_mutex_unlock(&worker->lock);
+}
+
+ListingState listing_worker_take(ListingWorker *worker, DirListing *listing, char *error, size_t error_size)
+{
+    uint64_t count;
+    if (read(worker->event_fd, &count, sizeof(count)) < 0)
+    {
+        // EAGAIN, nothing was posted since the last take
+    }
+    pthread_mutex_lock(&worker->lock);
+    bool ok = true;
+    for (int i = 0; listing && i < worker->count && ok; i++)
+    {
+        ok = dir_listing_push(listing, worker->uris[i], worker->types[i]);
+    }
+    drop_entries(worker);
+    ListingState state = ok ? worker->state : LISTING_FAILED;
+    snprintf(error, error_size, "%s", ok ? worker->error : "out of memory");
+    if (!ok)
+    {
+        cancel_locked(worker);
+    }
+    pthread_mutex_unlock(&worker->lock);
+    return state;
+}
+
+void listing_worker_stop(ListingWorker *worker)
+{
+    pthread_mutex_lock(&worker->lock);
+    cancel_locked(worker);
+    worker->quit = true;
+    pthread_cond_signal(&worker->wake);
+    pthread_mutex_unlock(&worker->lock);
+    pthread_join(worker->thread, NULL);
+
+    free(worker->uris);
+    free(worker->types);
+    pthread_mutex_destroy(&worker->lock);
+    pthread_cond_destroy(&worker->wake);
+    close(worker->event_fd);
+}
@@ -1,7 +1,34 @@
 #include "../include/lua_config.h"
+#include "../include/ascii_art.h"
 #include <stdio.h>
+#include <string.h>
 
-void config_lua(lua_State *L, char *starting_directory, char *connection_type, char *socket_path, char *host, int *port)
+// copy of path with a leading ~ replaced by $HOME, NULL if that can't be done
+static char *expand_home(const char *path)
+{
+    if (path[0] != '~' || (path[1] != '/' && path[1] != '\0'))
+    {
+        return strdup(path);
+    }
+    const char *home = getenv("HOME");
+    if (!home)
+    {
+        return NULL;
+    }
+    // get home path
+    size_t home_len = strlen(home);
+    size_t path_len = strlen(path + 1);
+    char *expanded = malloc(home_len + path_len + 1);
+    if (!expanded)
+    {
+        return NULL;
+    }
+    strcpy(expanded, home);
+    strcat(expanded, path + 1);
+    return expanded;
+}
+
+void config_lua(lua_State *L, Config *config)
 {
     // Places to check for config should be in current dir, and ~/.config/orpheus/config.lua
     if ( (luaL_dofile(L, "config.lua") == LUA_OK) || (luaL_dofile(L, "~/.config/orpheus/config.lua") == LUA_OK) )
@@ -10,31 +37,11 @@ void config_lua(lua_State *L, char *starting_directory, char *connection_type, c
         if (lua_isstring(L, -1))
         {
             const char *lua_path = lua_tostring(L, -1);
-            if (lua_path[0] == '~' && (lua_path[1] == '/' || lua_path[1] == '\0'))
+            char *expanded = expand_home(lua_path);
+            if (expanded)
             {
-                const char *home = getenv("HOME");
-                if (home)
-                {
-                    // get home path
-                    size_t home_len = strlen(home);
-                    size_t path_len = strlen(lua_path + 1);
-                    char *expanded = malloc(home_len + path_len + 2);
-                    strcpy(expanded, home);
-                    if (path_len > 0 && lua_path[1] == '/')
-                        strcat(expanded, lua_path + 1);
-                    else if (path_len > 0)
-                    {
-                        strcat(expanded, "/");
-                        strcat(expanded, lua_path + 1);
-                    }
-                    free(starting_directory);
-                    starting_directory = expanded;
-                }
-            }
-            else
-            {
-                free(starting_directory);
-                starting_directory = strdup(lua_path);
+                free(config->starting_directory);
+                config->starting_directory = expanded;
             }
             // Convert absolute path to relative if it starts with MPD's music_directory
             char mpd_music_dir[256];  // This shouldn't be that big, but if it becomes a problem oh well
@@ -52,12 +59,12 @@ void config_lua(lua_State *L, char *starting_directory, char *connection_type, c
 
             // Check if starting_directory begins with mpd_music_dir (length mpd_len) and is either
             // exactly mpd_music_dir or a subdirectory (ends with '/' or '\0')	
-            if (strncmp(starting_directory, mpd_music_dir, mpd_len) == 0 && 
-            (starting_directory[mpd_len] == '/' || starting_directory[mpd_len] == '\0'))
+            if (strncmp(config->starting_directory, mpd_music_dir, mpd_len) == 0 && 
+            (config->starting_directory[mpd_len] == '/' || config->starting_directory[mpd_len] == '\0'))
             {
-                char *relative = strdup(starting_directory + mpd_len + (starting_directory[mpd_len] == '/' ? 1 : 0));
-                free(starting_directory);
-                starting_directory = relative;
+                char *relative = strdup(config->starting_directory + mpd_len + (config->starting_directory[mpd_len] == '/' ? 1 : 0));
+                free(config->starting_directory);
+                config->starting_directory = relative;
             }
         }
         lua_pop(L, 1);
@@ -66,30 +73,90 @@ void config_lua(lua_State *L, char *starting_directory, char *connection_type, c
         lua_getglobal(L, "connection_type");
         if (lua_isstring(L, -1))
         {
-            connection_type = strdup(lua_tostring(L, -1));
+            config->connection_type = strdup(lua_tostring(L, -1));
         }
         lua_pop(L, 1);
 
         lua_getglobal(L, "socket_path");
         if (lua_isstring(L, -1))
         {
-            socket_path = strdup(lua_tostring(L, -1));
+            config->socket_path = strdup(lua_tostring(L, -1));
         }
         lua_pop(L, 1);
 
         lua_getglobal(L, "host");
         if (lua_isstring(L, -1))
         {
-            host = strdup(lua_tostring(L, -1));
+            config->host = strdup(lua_tostring(L, -1));
         }
         lua_pop(L, 1);
 
         lua_getglobal(L, "port");
         if (lua_isnumber(L, -1))
         {
-            *port = (int)lua_tointeger(L, -1);
+            config->port = (int)lua_tointeger(L, -1);
+        }
+        lua_pop(L, 1);
+
+        lua_getglobal(L, "music_root");
+        if (lua_isstring(L, -1))
+        {
+            free(config->music_root);
+            config->music_root = expand_home(lua_tostring(L, -1));
+        }
+        lua_pop(L, 1);
+
+        lua_getglobal(L, "art_cache_budget");
+        if (lua_isnumber(L, -1))
+        {
+            config->art_cache_budget = (int)lua_tointeger(L, -1);
+        }
+        lua_pop(L, 1);
+
+        lua_getglobal(L, "art_pack_limit");
+        if (lua_isnumber(L, -1))
+        {
+            config->art_pack_limit = (int)lua_tointeger(L, -1);
+        }
+        lua_pop(L, 1);
+
+        lua_getglobal(L, "visualizer_fifo");
+        if (lua_isstring(L, -1))
+        {
+            free(config->visualizer_fifo);
+            config->visualizer_fifo = expand_home(lua_tostring(L, -1));
+        }
+        lua_pop(L, 1);
+
+        lua_getglobal(L, "visualizer_rate");
+        if (lua_isnumber(L, -1))
+        {
+            config->visualizer_rate = (int)lua_tointeger(L, -1);
+        }
+        lua_pop(L, 1);
+
+        lua_getglobal(L, "art_mode");
+        if (lua_isstring(L, -1))
+        {
+            config->art_mode = strcmp(lua_tostring(L, -1), "inverted") == 0 ? ART_MODE_INVERTED : ART_MODE_ASCII;
         }
         lua_pop(L, 1);
     }
     lua_close(L);
-}
\ No newline at end of file
+}
+
+void config_free(Config *config)
+{
+    free(config->starting_directory);
+    free(config->connection_type);
+    free(config->socket_path);
+    free(config->host);
+    free(config->music_root);
+    free(config->visualizer_fifo);
+    config->starting_directory = NULL;
+    config->connection_type = NULL;
+    config->socket_path = NULL;
+    config->host = NULL;
+    config->music_root = NULL;
+    config->visualizer_fifo = NULL;
+}
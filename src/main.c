@@ -16,69 +16,63 @@
 #include "../include/mpd_connections.h"
 #include "../include/ui.h"
 #include "../include/lua_config.h"
+#include "../include/art_worker.h"
 
 // globals
-struct mpd_connection *conn;
+MpdLink connection;
 UI ui;
+ArtWorker art_worker;
+CommandWorker cmd_worker;
+LibraryWorker library_worker;
+FuzzyFinder fuzzy_finder;
+ListingWorker listing_worker;
+Spectrum spectrum;
 
 
 int main()
 {
     // local to main
-    char *starting_directory = strdup("");
-    char *connection_type = NULL;
-    char *socket_path = NULL;
-    char *host = NULL;
-    int port = 0;
+    Config config = { .starting_directory = strdup(""), .art_cache_budget = DEFAULT_ART_CACHE_BUDGET,
+                      .art_pack_limit = DEFAULT_ART_PACK_LIMIT, .visualizer_rate = DEFAULT_SPECTRUM_RATE };
 
     // setup lua
     lua_State *L = luaL_newstate();
     luaL_openlibs(L);
-    config_lua(L, starting_directory, connection_type, socket_path, host, &port);
+    config_lua(L, &config);
 
     // how we will define connection type
-    if (!connection_type)
+    if (!config.connection_type)
     {
-        connection_type = strdup("socket");
+        config.connection_type = strdup("socket");
     }
-    else if (!socket_path && strcmp(connection_type, "socket") == 0)
+    if (!config.socket_path && strcmp(config.connection_type, "socket") == 0)
     {
-        socket_path = strdup("/home/bay/.config/mpd/socket");
+        config.socket_path = strdup("/home/bay/.config/mpd/socket");
     }
-    else if (!host && strcmp(connection_type, "network") == 0)
+    if (!config.host && strcmp(config.connection_type, "network") == 0)
     {
-        host = strdup("localhost");
+        config.host = strdup("localhost");
     }
-    else if (port == 0 && strcmp(connection_type, "network") == 0)
+    if (config.port == 0 && strcmp(config.connection_type, "network") == 0)
     {
-        port = 6600;
+        config.port = 6600;
     }
 
     // make our mpd connection
-    if (strcmp(connection_type, "socket") == 0)
+    if (strcmp(config.connection_type, "socket") != 0 && strcmp(config.connection_type, "network") != 0)
     {
-        conn = mpd_connection_new(socket_path, 0, 0);
-    }
-    else if (strcmp(connection_type, "network") == 0)
-    {
-        conn = mpd_connection_new(host, port, 0);
+        fprintf(stderr, "Invalid connection_type: %s\n", config.connection_type);
+        config_free(&config);
+        if (isendwin() == FALSE) endwin();
+        exit(1);
     }
-    else
+    // mpd being down isn't fatal, the ui comes up and keeps reconnecting
+    if (!mpd_link_open(&connection, &config, IDLE_EVENTS) && !connection.cmd)
     {
-        fprintf(stderr, "Invalid connection_type: %s\n", connection_type);
-        free(starting_directory);
-        free(connection_type);
-        free(socket_path);
-        free(host);
-        if (isendwin() == FALSE) endwin();
+        fprintf(stderr, "Out of memory connecting to mpd\n");
+        config_free(&config);
         exit(1);
     }
-    validate_connection(conn);
-		
-    // clean up temp vars
-    free(connection_type);
-    free(socket_path);
-    free(host);
 
     printf("Before init ncurses\n");
 
@@ -94,18 +88,70 @@ int main()
     printf("Before init ui \n");
 
     // initialize our ui
-    init_ui(starting_directory, &ui);
-    free(starting_directory);
+    init_ui(config.starting_directory, &ui);
+    art_cache_init(&ui.art_cache, (size_t)config.art_cache_budget * 1024);
+    ui.art_mode = config.art_mode;
+    // covers rendered in earlier runs, the ui works the same without it
+    char *pack_path = art_pack_default_path();
+    art_pack_close(&ui.art_pack);
+    art_pack_open(&ui.art_pack, pack_path, (size_t)config.art_pack_limit * 1024);
+    free(pack_path);
 
     printf("After init ui \n");
 
+    // album art is fetched and decoded on its own thread and connection
+    if (art_worker_start(&art_worker, &config, &ui.art_pack))
+    {
+        ui.art_worker = &art_worker;
+    }
+
+    // playback commands go out on their own thread so keys never wait for mpd
+    if (cmd_worker_start(&cmd_worker, &config))
+    {
+        ui.cmd_worker = &cmd_worker;
+    }
+
+    // the library index is loaded in the background, the last run's snapshot serves until then
+    if (library_worker_start(&library_worker, &config))
+    {
+        library_worker_open_snapshot(&library_worker, &ui.library);
+        ui.library_worker = &library_worker;
+    }
+
+    // folders the library can't answer stream in from mpd without holding up the ui
+    if (listing_worker_start(&listing_worker, &config))
+    {
+        ui.dir_cache.worker = &listing_worker;
+    }
+
+    // the footer spectrum reads mpd's fifo output on its own thread, only if one is configured
+    if (config.visualizer_fifo && spectrum_start(&spectrum, config.visualizer_fifo, config.visualizer_rate))
+    {
+        ui.spectrum = &spectrum;
+    }
+
+    // fuzzy jump scores the library on a few threads of its own
+    if (fuzzy_finder_start(&fuzzy_finder, &ui.library))
+    {
+        ui.fuzzy = &fuzzy_finder;
+    }
+
     printf("Before run tui \n");
 
     // run tui
-    run_tui(conn, &ui);
+    run_tui(&connection, &ui);
     // clean up when user exits
+    if (ui.art_worker) art_worker_stop(&art_worker);
+    if (ui.cmd_worker) cmd_worker_stop(&cmd_worker);
+    if (ui.library_worker) library_worker_stop(&library_worker);
+    if (ui.fuzzy) fuzzy_finder_stop(&fuzzy_finder);
+    if (ui.spectrum) spectrum_stop(&spectrum);
+    // the cache lets go of the worker first, clean_tui below finds nothing streaming
+    dir_cache_clear(&ui.dir_cache);
+    if (ui.dir_cache.worker) listing_worker_stop(&listing_worker);
     clean_tui(&ui);
-    mpd_connection_free(conn);
+    mpd_link_close(&connection);
+    config_free(&config);
 
     return 0;
 }
@@ -1,20 +1,207 @@
 #include "../include/mpd_connections.h"
 
+// opens a connection over the socket or network as configured
+struct mpd_connection *open_connection(const Config *config)
+{
+    struct mpd_connection *conn;
+    if (strcmp(config->connection_type, "network") == 0)
+    {
+        conn = mpd_connection_new(config->host, config->port, MPD_TIMEOUT_MS);
+    }
+    else
+    {
+        conn = mpd_connection_new(config->socket_path, 0, MPD_TIMEOUT_MS);
+    }
+    // never block forever on a server that stopped answering
+    if (conn) mpd_connection_set_timeout(conn, MPD_TIMEOUT_MS);
+    return conn;
+}
+
+bool connection_lost(struct mpd_connection *conn)
+{
+    // mpd closes connections that were quiet for its connection_timeout, 60s by default
+    enum mpd_error error = mpd_connection_get_error(conn);
+    return error == MPD_ERROR_CLOSED || error == MPD_ERROR_TIMEOUT || error == MPD_ERROR_SYSTEM;
+}
+
+static bool usable(struct mpd_connection *conn)
+{
+    return conn && mpd_connection_get_error(conn) == MPD_ERROR_SUCCESS;
+}
+
+// server errors (a bad uri, ...) leave the connection fine, anything else broke it
+static bool broken(struct mpd_connection *conn)
+{
+    return mpd_connection_get_error(conn) != MPD_ERROR_SUCCESS && !mpd_connection_clear_error(conn);
+}
+
+static void schedule_retry(MpdLink *link)
+{
+    clock_gettime(CLOCK_MONOTONIC, &link->retry_at);
+    link->retry_at.tv_sec += link->retry_ms / 1000;
+    link->retry_at.tv_nsec += (long)(link->retry_ms % 1000) * 1000000L;
+    if (link->retry_at.tv_nsec >= 1000000000L)
+    {
+        link->retry_at.tv_sec++;
+        link->retry_at.tv_nsec -= 1000000000L;
+    }
+}
+
+// try both connections, only swapping them in if both work
+static bool connect_both(MpdLink *link)
+{
+    struct mpd_connection *cmd = open_connection(link->config);
+    struct mpd_connection *idle = usable(cmd) ? open_connection(link->config) : NULL;
+    if (!usable(cmd) || !usable(idle))
+    {
+        if (idle) mpd_connection_free(idle);
+        // keep a failed connection as cmd so callers always have something to talk to
+        if (!link->cmd) link->cmd = cmd;
+        else if (cmd) mpd_connection_free(cmd);
+        return false;
+    }
+
+    if (link->cmd) mpd_connection_free(link->cmd);
+    link->cmd = cmd;
+    link->idle = idle;
+    link->idling = false; // the subscription is sent again on the new idle connection
+    link->connected = true;
+    clock_gettime(CLOCK_MONOTONIC, &link->pinged);
+    link->retry_ms = MPD_RETRY_MIN_MS;
+    return true;
+}
+
+bool mpd_link_open(MpdLink *link, const Config *config, enum mpd_idle mask)
+{
+    memset(link, 0, sizeof(MpdLink));
+    link->config = config;
+    link->mask = mask;
+    link->retry_ms = MPD_RETRY_MIN_MS;
+    if (connect_both(link))
+    {
+        return true;
+    }
+    schedule_retry(link);
+    return false;
+}
+
+bool mpd_link_check(MpdLink *link)
+{
+    if (!link->connected)
+    {
+        return false;
+    }
+    if (!broken(link->idle) && connection_lost(link->cmd))
+    {
+        // mpd closed a quiet cmd (or a ping timed out) but idle says mpd is there, try a fresh cmd first
+        struct mpd_connection *cmd = open_connection(link->config);
+        if (usable(cmd))
+        {
+            mpd_connection_free(link->cmd);
+            link->cmd = cmd;
+            link->cmd_reopened = true;
+            clock_gettime(CLOCK_MONOTONIC, &link->pinged);
+            return true;
+        }
+        if (cmd) mpd_connection_free(cmd);
+    }
+    if (!broken(link->cmd) && !broken(link->idle))
+    {
+        return true;
+    }
+    // mpd restarted or the network went away; cmd stays around in its failed state
+    mpd_connection_free(link->idle);
+    link->idle = NULL;
+    link->idling = false;
+    link->connected = false;
+    link->retry_ms = MPD_RETRY_MIN_MS;
+    schedule_retry(link);
+    return false;
+}
+
+void mpd_link_keepalive(MpdLink *link)
+{
+    if (!link->connected)
+    {
+        return;
+    }
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    long long ms = (long long)(now.tv_sec - link->pinged.tv_sec) * 1000 + (now.tv_nsec - link->pinged.tv_nsec) / 1000000;
+    if (ms < MPD_KEEPALIVE_MS)
+    {
+        return;
+    }
+    link->pinged = now;
+    // a failure stays on cmd for mpd_link_check
+    if (mpd_send_command(link->cmd, "ping", NULL))
+    {
+        mpd_response_finish(link->cmd);
+    }
+}
+
+bool mpd_link_retry(MpdLink *link)
+{
+    if (link->connected || mpd_link_retry_timeout(link) > 0)
+    {
+        return false;
+    }
+    if (connect_both(link))
+    {
+        link->reconnects++;
+        return true;
+    }
+    link->retry_ms = link->retry_ms * 2 > MPD_RETRY_MAX_MS ? MPD_RETRY_MAX_MS : link->retry_ms * 2;
+    schedule_retry(link);
+    return false;
+}
+
+int mpd_link_retry_timeout(const MpdLink *link)
+{
+    if (link->connected)
+    {
+        return -1;
+    }
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    long long ms = (long long)(link->retry_at.tv_sec - now.tv_sec) * 1000 + (link->retry_at.tv_nsec - now.tv_nsec) / 1000000;
+    return ms > 0 ? (int)ms : 0;
+}
 
-// validates a mpd connection given the mpd struct
-void validate_connection(struct mpd_connection *conn)
+int mpd_link_idle_fd(MpdLink *link)
 {
-    if (conn == NULL) 
+    if (!link->connected)
     {
-        perror("CONN == NULL ? we dont know what happened");
-        if (isendwin() == FALSE) endwin();
-        exit(1);
+        return -1;
     }
-    if (mpd_connection_get_error(conn) != MPD_ERROR_SUCCESS) 
+    if (!link->idling)
     {
-        fprintf(stderr, "MPD error: %s\n", mpd_connection_get_error_message(conn));
-        mpd_connection_free(conn);
-        if (isendwin() == FALSE) endwin();
-        exit(1);
+        link->idling = mpd_send_idle_mask(link->idle, link->mask);
+        if (!link->idling)
+        {
+            return -1;
+        }
     }
-}
\ No newline at end of file
+    return mpd_connection_get_fd(link->idle);
+}
+
+enum mpd_idle mpd_link_idle_events(MpdLink *link)
+{
+    if (!link->connected || !link->idling)
+    {
+        return 0;
+    }
+    link->idling = false;
+    enum mpd_idle events = mpd_recv_idle(link->idle, false);
+    mpd_response_finish(link->idle);
+    return events;
+}
+
+void mpd_link_close(MpdLink *link)
+{
+    if (link->idle) mpd_connection_free(link->idle);
+    if (link->cmd) mpd_connection_free(link->cmd);
+    link->idle = NULL;
+    link->cmd = NULL;
+    link->connected = false;
+}
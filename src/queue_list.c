@@ -0,0 +1,157 @@
+#include "../include/queue_list.h"
+
+// "artist - title", just the title, or the file name when the song has no tags
+static char *format_title(const struct mpd_song *song)
+{
+    const char *artist = mpd_song_get_tag(song, MPD_TAG_ARTIST, 0);
+    const char *title = mpd_song_get_tag(song, MPD_TAG_TITLE, 0);
+    if (!title)
+    {
+        const char *uri = mpd_song_get_uri(song);
+        const char *slash = strrchr(uri, '/');
+        return strdup(slash ? slash + 1 : uri);
+    }
+    if (!artist)
+    {
+        return strdup(title);
+    }
+    size_t size = strlen(artist) + strlen(title) + 4;
+    char *text = malloc(size);
+    if (text) snprintf(text, size, "%s - %s", artist, title);
+    return text;
+}
+
+static void drop_title(QueueEntry *entry)
+{
+    free(entry->title);
+    entry->title = NULL;
+}
+
+// grow or shrink to length positions, new positions start out unloaded
+static bool resize(QueueList *list, int length)
+{
+    if (length < 0) length = 0;
+    if (length > list->capacity)
+    {
+        int capacity = list->capacity ? list->capacity : 256;
+        while (capacity < length) capacity *= 2;
+        QueueEntry *grown = realloc(list->entries, capacity * sizeof(QueueEntry));
+        if (!grown) return false;
+        list->entries = grown;
+        list->capacity = capacity;
+    }
+    for (int i = length; i < list->length; i++)
+    {
+        drop_title(&list->entries[i]);
+    }
+    if (length > list->length)
+    {
+        memset(list->entries + list->length, 0, (length - list->length) * sizeof(QueueEntry));
+    }
+    list->length = length;
+    return true;
+}
+
+void queue_list_init(QueueList *list)
+{
+    memset(list, 0, sizeof(QueueList));
+}
+
+void queue_list_reset(QueueList *list)
+{
+    for (int i = 0; i < list->length; i++)
+    {
+        drop_title(&list->entries[i]);
+        list->entries[i].id = 0;
+    }
+    list->synced = false;
+}
+
+bool queue_list_sync(QueueList *list, struct mpd_connection *conn, unsigned version, int length)
+{
+    if (list->synced && list->version == version && list->length == length)
+    {
+        return true;
+    }
+    // new positions may show up in the changes, so make room first
+    if (!resize(list, length))
+    {
+        return false;
+    }
+    if (!list->synced)
+    {
+        // nothing to diff against, every row just loads when it's looked at
+        queue_list_reset(list);
+        list->version = version;
+        list->synced = true;
+        return true;
+    }
+
+    // plchangesposid: only position and id of what changed, titles are fetched for visible rows later
+    if (!mpd_send_queue_changes_brief(conn, list->version))
+    {
+        list->synced = false;
+        return false;
+    }
+    unsigned pos, id;
+    while (mpd_recv_queue_change_brief(conn, &pos, &id))
+    {
+        if (pos < (unsigned)list->length)
+        {
+            // same id can still mean new tags after a database update
+            drop_title(&list->entries[pos]);
+            list->entries[pos].id = id;
+        }
+    }
+    if (!mpd_response_finish(conn))
+    {
+        list->synced = false;
+        return false;
+    }
+    list->version = version;
+    return true;
+}
+
+bool queue_list_load(QueueList *list, struct mpd_connection *conn, int start, int end)
+{
+    if (start < 0) start = 0;
+    if (end > list->length) end = list->length;
+    // trim loaded rows off both ends, whatever is left goes in one request
+    while (start < end && list->entries[start].title) start++;
+    while (end > start && list->entries[end - 1].title) end--;
+    if (start >= end)
+    {
+        return true;
+    }
+
+    if (!mpd_send_list_queue_range_meta(conn, start, end))
+    {
+        return false;
+    }
+    struct mpd_song *song;
+    while ((song = mpd_recv_song(conn)))
+    {
+        unsigned pos = mpd_song_get_pos(song);
+        if (pos < (unsigned)list->length)
+        {
+            QueueEntry *entry = &list->entries[pos];
+            free(entry->title);
+            entry->title = format_title(song);
+            entry->id = mpd_song_get_id(song);
+        }
+        mpd_song_free(song);
+    }
+    return mpd_response_finish(conn);
+}
+
+const char *queue_list_title(const QueueList *list, int pos)
+{
+    return pos >= 0 && pos < list->length ? list->entries[pos].title : NULL;
+}
+
+void queue_list_free(QueueList *list)
+{
+    resize(list, 0);
+    free(list->entries);
+    queue_list_init(list);
+}
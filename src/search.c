@@ -0,0 +1,469 @@
+#include "../include/search.h"
+#include <ctype.h>
+#include <strings.h>
+
+#define SEARCH_VALUE_MAX 128
+
+// field SEARCH_FIELDS means a bare word, matched against artist, album and title
+typedef struct
+{
+    SearchField field;
+    char value[SEARCH_VALUE_MAX]; // lowercased
+} SearchTerm;
+
+static const char *const field_names[] = { "artist", "album", "title", "year", "date" };
+static const SearchField named_fields[] = { SEARCH_ARTIST, SEARCH_ALBUM, SEARCH_TITLE, SEARCH_DATE, SEARCH_DATE };
+static const enum mpd_tag_type field_tags[SEARCH_FIELDS] = { MPD_TAG_ARTIST, MPD_TAG_ALBUM, MPD_TAG_TITLE, MPD_TAG_DATE };
+
+// split query into terms: field:value, field:"value with spaces" or a bare word
+static int parse_query(const char *query, SearchTerm *terms)
+{
+    int count = 0;
+    const char *p = query;
+    while (*p && count < SEARCH_MAX_TERMS)
+    {
+        while (*p == ' ') p++;
+        if (!*p) break;
+
+        SearchTerm *term = &terms[count];
+        term->field = SEARCH_FIELDS;
+        const char *colon = strchr(p, ':');
+        const char *space = strchr(p, ' ');
+        if (colon && (!space || colon < space))
+        {
+            // unknown prefixes stay part of a bare word
+            for (size_t f = 0; f < sizeof(field_names) / sizeof(field_names[0]); f++)
+            {
+                if (strlen(field_names[f]) == (size_t)(colon - p) && strncasecmp(p, field_names[f], colon - p) == 0)
+                {
+                    term->field = named_fields[f];
+                    p = colon + 1;
+                    break;
+                }
+            }
+        }
+
+        size_t n = 0;
+        char end = ' ';
+        if (*p == '"')
+        {
+            end = '"';
+            p++;
+        }
+        for (; *p && *p != end; p++)
+        {
+            if (n < SEARCH_VALUE_MAX - 1) term->value[n++] = (char)tolower((unsigned char)*p);
+        }
+        if (*p == '"') p++;
+        term->value[n] = '\0';
+        if (n > 0) count++;
+    }
+    return count;
+}
+
+// next value at or after *value containing needle (starting with it when prefix, "year:199" is the nineties);
+// memchr does the skipping over the folded text, *value is left past the match for the next call
+static bool next_match(const TagPostings *tags, const char *needle, size_t len, bool prefix, uint32_t *value)
+{
+    const char *folded = tags->folded;
+    const char *end = folded + tags->starts[tags->value_count];
+    uint32_t v = *value;
+    const char *p = folded + tags->starts[v];
+    while (p < end && (p = memchr(p, needle[0], end - p)) != NULL)
+    {
+        if ((size_t)(end - p) >= len && memcmp(p, needle, len) == 0)
+        {
+            // hits only move forward, so walking to the value beats a binary search
+            while (folded + tags->starts[v + 1] <= p) v++;
+            if (!prefix || folded + tags->starts[v] == p)
+            {
+                *value = v + 1;
+                return true;
+            }
+            // the rest of this value can't add anything
+            p = folded + tags->starts[++v];
+        }
+        else
+        {
+            p++;
+        }
+    }
+    *value = tags->value_count;
+    return false;
+}
+
+static int compare_pairs(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+void search_index_init(SearchIndex *index, const Library *library)
+{
+    memset(index, 0, sizeof(SearchIndex));
+    index->library = library;
+}
+
+bool search_index_build(SearchIndex *index)
+{
+    search_index_free(index);
+    const Library *library = index->library;
+    if (!library->loaded)
+    {
+        return false;
+    }
+    uint32_t songs = library->song_count;
+    const LibStr *tags[SEARCH_FIELDS] = { library->song_artist, library->song_album, library->song_title, library->song_date };
+
+    // (value, song) pairs sorted once give every value's songs already in order
+    uint64_t *pairs = malloc((size_t)(songs ? songs : 1) * sizeof(uint64_t));
+    index->bitmap = calloc((songs + 63) / 64 + 1, sizeof(uint64_t));
+    if (!pairs || !index->bitmap)
+    {
+        free(pairs);
+        search_index_free(index);
+        return false;
+    }
+    for (int f = 0; f < SEARCH_FIELDS; f++)
+    {
+        uint32_t count = 0;
+        for (uint32_t s = 0; s < songs; s++)
+        {
+            if (tags[f][s]) pairs[count++] = (uint64_t)tags[f][s] << 32 | s;
+        }
+        qsort(pairs, count, sizeof(uint64_t), compare_pairs);
+
+        uint32_t distinct = 0;
+        for (uint32_t i = 0; i < count; i++)
+        {
+            if (i == 0 || pairs[i] >> 32 != pairs[i - 1] >> 32) distinct++;
+        }
+        TagPostings *field = &index->fields[f];
+        field->values = malloc((size_t)(distinct ? distinct : 1) * sizeof(LibStr));
+        field->offsets = malloc((size_t)(distinct + 1) * sizeof(uint32_t));
+        field->postings = malloc((size_t)(count ? count : 1) * sizeof(uint32_t));
+        if (!field->values || !field->offsets || !field->postings)
+        {
+            free(pairs);
+            search_index_free(index);
+            return false;
+        }
+        uint32_t v = 0;
+        for (uint32_t i = 0; i < count; i++)
+        {
+            if (i == 0 || pairs[i] >> 32 != pairs[i - 1] >> 32)
+            {
+                field->values[v] = (LibStr)(pairs[i] >> 32);
+                field->offsets[v++] = i;
+            }
+            field->postings[i] = (uint32_t)pairs[i];
+        }
+        field->offsets[distinct] = count;
+        field->value_count = distinct;
+
+        // lowercased copy of the values back to back, what terms are matched against
+        uint64_t folded_size = 0;
+        for (uint32_t i = 0; i < distinct; i++) folded_size += strlen(library_str(library, field->values[i])) + 1;
+        field->folded = malloc(folded_size ? folded_size : 1);
+        field->starts = malloc((size_t)(distinct + 1) * sizeof(uint32_t));
+        if (!field->folded || !field->starts || folded_size > UINT32_MAX)
+        {
+            free(pairs);
+            search_index_free(index);
+            return false;
+        }
+        uint32_t at = 0;
+        for (uint32_t i = 0; i < distinct; i++)
+        {
+            field->starts[i] = at;
+            for (const char *c = library_str(library, field->values[i]); *c; c++)
+            {
+                field->folded[at++] = (char)tolower((unsigned char)*c);
+            }
+            field->folded[at++] = '\0';
+        }
+        field->starts[distinct] = at;
+    }
+    free(pairs);
+    index->built = true;
+    return true;
+}
+
+void search_index_free(SearchIndex *index)
+{
+    for (int f = 0; f < SEARCH_FIELDS; f++)
+    {
+        free(index->fields[f].values);
+        free(index->fields[f].offsets);
+        free(index->fields[f].postings);
+        free(index->fields[f].folded);
+        free(index->fields[f].starts);
+    }
+    free(index->bitmap);
+    search_index_init(index, index->library);
+}
+
+// songs matching term, ascending; points into the index unless *owned (then the caller frees)
+static bool match_term(SearchIndex *index, const SearchTerm *term, const uint32_t **list, uint32_t *count, bool *owned)
+{
+    const Library *library = index->library;
+    SearchField first = term->field == SEARCH_FIELDS ? SEARCH_ARTIST : term->field;
+    SearchField last = term->field == SEARCH_FIELDS ? SEARCH_TITLE : term->field;
+    uint32_t words = (library->song_count + 63) / 64;
+    size_t len = strlen(term->value);
+    int matched = 0;
+    *list = NULL;
+    *count = 0;
+    *owned = false;
+
+    for (int f = first; f <= (int)last; f++)
+    {
+        const TagPostings *tags = &index->fields[f];
+        uint32_t next = 0;
+        while (next < tags->value_count && next_match(tags, term->value, len, f == SEARCH_DATE, &next))
+        {
+            uint32_t v = next - 1;
+            const uint32_t *postings = tags->postings + tags->offsets[v];
+            uint32_t n = tags->offsets[v + 1] - tags->offsets[v];
+            // a single matching value needs no union at all
+            if (matched == 0)
+            {
+                *list = postings;
+                *count = n;
+            }
+            else
+            {
+                if (matched == 1)
+                {
+                    memset(index->bitmap, 0, words * sizeof(uint64_t));
+                    for (uint32_t i = 0; i < *count; i++) index->bitmap[(*list)[i] / 64] |= 1ull << ((*list)[i] % 64);
+                }
+                for (uint32_t i = 0; i < n; i++) index->bitmap[postings[i] / 64] |= 1ull << (postings[i] % 64);
+            }
+            matched++;
+        }
+    }
+    if (matched < 2)
+    {
+        return true;
+    }
+
+    uint32_t total = 0;
+    for (uint32_t w = 0; w < words; w++) total += __builtin_popcountll(index->bitmap[w]);
+    uint32_t *songs = malloc((size_t)(total ? total : 1) * sizeof(uint32_t));
+    if (!songs) return false;
+    uint32_t n = 0;
+    for (uint32_t w = 0; w < words; w++)
+    {
+        for (uint64_t bits = index->bitmap[w]; bits; bits &= bits - 1)
+        {
+            songs[n++] = w * 64 + __builtin_ctzll(bits);
+        }
+    }
+    *list = songs;
+    *count = n;
+    *owned = true;
+    return true;
+}
+
+// first position in [lo, n) whose value is >= value, probing 1, 2, 4, ... ahead before bisecting
+static uint32_t gallop(const uint32_t *list, uint32_t n, uint32_t lo, uint32_t value)
+{
+    uint32_t hi = lo;
+    uint32_t step = 1;
+    while (hi < n && list[hi] < value)
+    {
+        lo = hi + 1;
+        hi += step;
+        step *= 2;
+    }
+    if (hi > n) hi = n;
+    while (lo < hi)
+    {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (list[mid] < value) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+// keep the entries of a[0..na) that are also in b, in place; a should be the shorter list
+static uint32_t intersect(uint32_t *a, uint32_t na, const uint32_t *b, uint32_t nb)
+{
+    uint32_t kept = 0;
+    uint32_t j = 0;
+    for (uint32_t i = 0; i < na && j < nb; i++)
+    {
+        j = gallop(b, nb, j, a[i]);
+        if (j < nb && b[j] == a[i]) a[kept++] = a[i];
+    }
+    return kept;
+}
+
+bool search_run_index(SearchIndex *index, const char *query, SearchResults *results)
+{
+    search_results_clear(results);
+    if (!index->built && !search_index_build(index))
+    {
+        return false;
+    }
+    SearchTerm terms[SEARCH_MAX_TERMS];
+    int count = parse_query(query, terms);
+    if (count == 0)
+    {
+        return true;
+    }
+
+    const uint32_t *lists[SEARCH_MAX_TERMS];
+    uint32_t sizes[SEARCH_MAX_TERMS];
+    bool owned[SEARCH_MAX_TERMS];
+    int order[SEARCH_MAX_TERMS];
+    bool ok = true;
+    int matched = 0;
+    for (; matched < count && ok; matched++)
+    {
+        ok = match_term(index, &terms[matched], &lists[matched], &sizes[matched], &owned[matched]);
+    }
+    if (!ok) matched--;
+
+    // smallest list first, every intersection is then at most that long
+    for (int i = 0; i < matched; i++)
+    {
+        int j = i;
+        while (j > 0 && sizes[order[j - 1]] > sizes[i])
+        {
+            order[j] = order[j - 1];
+            j--;
+        }
+        order[j] = i;
+    }
+    uint32_t *songs = NULL;
+    uint32_t n = 0;
+    if (ok)
+    {
+        n = sizes[order[0]];
+        songs = malloc((size_t)(n ? n : 1) * sizeof(uint32_t));
+        ok = songs != NULL;
+    }
+    if (ok)
+    {
+        if (n) memcpy(songs, lists[order[0]], (size_t)n * sizeof(uint32_t));
+        for (int k = 1; k < matched && n > 0; k++)
+        {
+            n = intersect(songs, n, lists[order[k]], sizes[order[k]]);
+        }
+        results->songs = songs;
+        results->count = (int)n;
+    }
+    for (int i = 0; i < matched; i++)
+    {
+        if (owned[i]) free((uint32_t *)lists[i]);
+    }
+    return ok;
+}
+
+// "artist - title (album)", the file name stands in for a missing title
+static void format_label(char *label, size_t size, const char *uri, const char *artist, const char *title, const char *album)
+{
+    if (!title || !*title)
+    {
+        const char *slash = strrchr(uri, '/');
+        title = slash ? slash + 1 : uri;
+    }
+    int n = artist && *artist ? snprintf(label, size, "%s - %s", artist, title) : snprintf(label, size, "%s", title);
+    if (album && *album && n >= 0 && (size_t)n < size)
+    {
+        snprintf(label + n, size - n, " (%s)", album);
+    }
+}
+
+bool search_run_server(struct mpd_connection *conn, const char *query, SearchResults *results)
+{
+    search_results_clear(results);
+    results->from_server = true;
+    SearchTerm terms[SEARCH_MAX_TERMS];
+    int count = parse_query(query, terms);
+    if (count == 0)
+    {
+        return true;
+    }
+
+    // mpd's default operator is the same case-insensitive substring match
+    bool ok = mpd_search_db_songs(conn, false);
+    for (int i = 0; ok && i < count; i++)
+    {
+        ok = terms[i].field == SEARCH_FIELDS
+            ? mpd_search_add_any_tag_constraint(conn, MPD_OPERATOR_DEFAULT, terms[i].value)
+            : mpd_search_add_tag_constraint(conn, MPD_OPERATOR_DEFAULT, field_tags[terms[i].field], terms[i].value);
+    }
+    ok = ok && mpd_search_add_window(conn, 0, SEARCH_SERVER_LIMIT) && mpd_search_commit(conn);
+    if (!ok)
+    {
+        mpd_search_cancel(conn);
+        return false;
+    }
+
+    results->uris = malloc(SEARCH_SERVER_LIMIT * sizeof(char *));
+    results->labels = malloc(SEARCH_SERVER_LIMIT * sizeof(char *));
+    struct mpd_song *song;
+    while ((song = mpd_recv_song(conn)) != NULL)
+    {
+        // after running out of memory we still drain the response
+        if (results->uris && results->labels && results->count < SEARCH_SERVER_LIMIT)
+        {
+            char label[256];
+            const char *uri = mpd_song_get_uri(song);
+            format_label(label, sizeof(label), uri, mpd_song_get_tag(song, MPD_TAG_ARTIST, 0),
+                         mpd_song_get_tag(song, MPD_TAG_TITLE, 0), mpd_song_get_tag(song, MPD_TAG_ALBUM, 0));
+            char *uri_copy = strdup(uri);
+            char *label_copy = strdup(label);
+            if (uri_copy && label_copy)
+            {
+                results->uris[results->count] = uri_copy;
+                results->labels[results->count] = label_copy;
+                results->count++;
+            }
+            else
+            {
+                free(uri_copy);
+                free(label_copy);
+            }
+        }
+        mpd_song_free(song);
+    }
+    return mpd_response_finish(conn);
+}
+
+const char *search_result_uri(const SearchResults *results, const Library *library, int i)
+{
+    return results->from_server ? results->uris[i] : library_str(library, library->song_uri[results->songs[i]]);
+}
+
+void search_result_label(const SearchResults *results, const Library *library, int i, char *label, size_t size)
+{
+    if (results->from_server)
+    {
+        snprintf(label, size, "%s", results->labels[i]);
+        return;
+    }
+    uint32_t song = results->songs[i];
+    format_label(label, size, library_str(library, library->song_uri[song]), library_str(library, library->song_artist[song]),
+                 library_str(library, library->song_title[song]), library_str(library, library->song_album[song]));
+}
+
+void search_results_clear(SearchResults *results)
+{
+    if (results->from_server)
+    {
+        for (int i = 0; i < results->count; i++)
+        {
+            free(results->uris[i]);
+            free(results->labels[i]);
+        }
+    }
+    free(results->songs);
+    free(results->uris);
+    free(results->labels);
+    memset(results, 0, sizeof(SearchResults));
+}
@@ -0,0 +1,115 @@
+#include "../include/selection.h"
+
+// FNV-1a, same as the other caches
+static unsigned hash_uri(const char *uri)
+{
+    unsigned hash = 2166136261u;
+    for (const unsigned char *p = (const unsigned char *)uri; *p; p++)
+    {
+        hash ^= *p;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// slot holding uri, or the empty slot it would go in
+static int find_slot(const Selection *selection, const char *uri)
+{
+    unsigned mask = (unsigned)selection->table_size - 1;
+    for (unsigned slot = hash_uri(uri) & mask;; slot = (slot + 1) & mask)
+    {
+        int index = selection->table[slot];
+        if (index < 0 || strcmp(selection->uris[index], uri) == 0)
+        {
+            return (int)slot;
+        }
+    }
+}
+
+// rebuild the index at size slots (also how removals are done)
+static bool rebuild_table(Selection *selection, int size)
+{
+    int *table = size == selection->table_size ? selection->table : malloc(size * sizeof(int));
+    if (!table) return false;
+    if (table != selection->table) free(selection->table);
+    selection->table = table;
+    selection->table_size = size;
+    memset(table, -1, size * sizeof(int));
+    for (int i = 0; i < selection->count; i++)
+    {
+        table[find_slot(selection, selection->uris[i])] = i;
+    }
+    return true;
+}
+
+void selection_init(Selection *selection)
+{
+    memset(selection, 0, sizeof(Selection));
+}
+
+bool selection_contains(const Selection *selection, const char *uri)
+{
+    return selection->count > 0 && selection->table[find_slot(selection, uri)] >= 0;
+}
+
+bool selection_add(Selection *selection, const char *uri)
+{
+    if (selection_contains(selection, uri))
+    {
+        return true;
+    }
+    if (selection->count == selection->capacity)
+    {
+        int capacity = selection->capacity ? selection->capacity * 2 : 64;
+        char **grown = realloc(selection->uris, capacity * sizeof(char *));
+        if (!grown) return false;
+        selection->uris = grown;
+        selection->capacity = capacity;
+    }
+    if ((selection->count + 1) * 2 > selection->table_size &&
+        !rebuild_table(selection, selection->table_size ? selection->table_size * 2 : 128))
+    {
+        return false;
+    }
+    char *copy = strdup(uri);
+    if (!copy) return false;
+    selection->uris[selection->count] = copy;
+    selection->table[find_slot(selection, uri)] = selection->count;
+    selection->count++;
+    return true;
+}
+
+bool selection_toggle(Selection *selection, const char *uri)
+{
+    if (!selection_contains(selection, uri))
+    {
+        return selection_add(selection, uri);
+    }
+    // unmarking is rare, close the gap and reindex
+    int index = selection->table[find_slot(selection, uri)];
+    free(selection->uris[index]);
+    memmove(&selection->uris[index], &selection->uris[index + 1], (selection->count - index - 1) * sizeof(char *));
+    selection->count--;
+    rebuild_table(selection, selection->table_size);
+    return false;
+}
+
+char **selection_take(Selection *selection, int *count)
+{
+    char **uris = selection->uris;
+    *count = selection->count;
+    free(selection->table);
+    selection_init(selection);
+    return uris;
+}
+
+void selection_clear(Selection *selection)
+{
+    for (int i = 0; i < selection->count; i++)
+    {
+        free(selection->uris[i]);
+    }
+    free(selection->uris);
+    free(selection->table);
+    selection_init(selection);
+}
@@ -0,0 +1,330 @@
+#include "../include/spectrum.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define SPECTRUM_TAU 6.28318530717958647692f
+// bands span this range, capped at the nyquist frequency
+#define SPECTRUM_LOW_HZ 40.0
+#define SPECTRUM_HIGH_HZ 16000.0
+// level lost per frame after a peak, a full bar falls in about half a second
+#define SPECTRUM_FALL 0.035f
+// how long to wait for audio before the bars drop, or before looking for the fifo again
+#define SPECTRUM_NAP_MS 100
+
+static void nap(int ms)
+{
+    struct timespec ts = { ms / 1000, (ms % 1000) * 1000000L };
+    nanosleep(&ts, NULL);
+}
+
+static void poke(Spectrum *spectrum)
+{
+    uint64_t one = 1;
+    if (write(spectrum->event_fd, &one, sizeof(one)) < 0)
+    {
+        // the counter can only overflow if the ui stopped reading, nothing to do
+    }
+}
+
+// window, twiddles and the input permutation, once per start
+static void build_tables(Spectrum *spectrum)
+{
+    const int n = SPECTRUM_FFT_SIZE;
+    int bits = 0;
+    while ((1 << bits) < n) bits++;
+    for (int i = 0; i < n; i++)
+    {
+        spectrum->window[i] = 0.5f - 0.5f * cosf(SPECTRUM_TAU * i / (n - 1));
+        unsigned reversed = 0;
+        for (int b = 0; b < bits; b++)
+        {
+            reversed |= ((i >> b) & 1u) << (bits - 1 - b);
+        }
+        spectrum->bit_reverse[i] = (uint16_t)reversed;
+    }
+    for (int k = 0; k < n / 2; k++)
+    {
+        spectrum->cos_table[k] = cosf(SPECTRUM_TAU * k / n);
+        spectrum->sin_table[k] = sinf(SPECTRUM_TAU * k / n);
+    }
+}
+
+// in place radix-2 decimation in time, input already in bit reversed order
+static void fft(Spectrum *spectrum)
+{
+    float *re = spectrum->re;
+    float *im = spectrum->im;
+    const int n = SPECTRUM_FFT_SIZE;
+    for (int size = 2; size <= n; size *= 2)
+    {
+        int half = size / 2;
+        int step = n / size;
+        for (int start = 0; start < n; start += size)
+        {
+            for (int k = 0; k < half; k++)
+            {
+                float wr = spectrum->cos_table[k * step];
+                float wi = -spectrum->sin_table[k * step];
+                int a = start + k;
+                int b = a + half;
+                float tr = re[b] * wr - im[b] * wi;
+                float ti = re[b] * wi + im[b] * wr;
+                re[b] = re[a] - tr;
+                im[b] = im[a] - ti;
+                re[a] += tr;
+                im[a] += ti;
+            }
+        }
+    }
+}
+
+// first bin of each of count log spaced bands, every band at least one bin wide
+static void build_edges(Spectrum *spectrum, int count)
+{
+    const int n = SPECTRUM_FFT_SIZE;
+    double high = spectrum->rate / 2.0 < SPECTRUM_HIGH_HZ ? spectrum->rate / 2.0 : SPECTRUM_HIGH_HZ;
+    double ratio = log(high / SPECTRUM_LOW_HZ);
+    int previous = 0;
+    for (int b = 0; b <= count; b++)
+    {
+        double hz = SPECTRUM_LOW_HZ * exp(ratio * b / count);
+        int bin = (int)(hz * n / spectrum->rate);
+        if (bin <= previous) bin = previous + 1;
+        if (bin > n / 2) bin = n / 2;
+        spectrum->edges[b] = bin;
+        previous = bin;
+    }
+    spectrum->edge_count = count;
+}
+
+// analyse the current window and hand the bands to the ui, dropped if it's a full ring behind
+static void publish(Spectrum *spectrum, bool silent)
+{
+    int count = atomic_load_explicit(&spectrum->bands, memory_order_relaxed);
+    if (count < 1) count = 1;
+    if (count > SPECTRUM_MAX_BANDS) count = SPECTRUM_MAX_BANDS;
+    if (count != spectrum->edge_count)
+    {
+        build_edges(spectrum, count);
+        memset(spectrum->levels, 0, sizeof(spectrum->levels));
+    }
+
+    if (!silent)
+    {
+        for (int i = 0; i < SPECTRUM_FFT_SIZE; i++)
+        {
+            int j = spectrum->bit_reverse[i];
+            spectrum->re[j] = spectrum->samples[i] * spectrum->window[i];
+            spectrum->im[j] = 0.0f;
+        }
+        fft(spectrum);
+    }
+    // a full scale sine peaks at n/4 with the Hann window's 0.5 gain
+    const float scale = 4.0f / SPECTRUM_FFT_SIZE;
+    for (int b = 0; b < count; b++)
+    {
+        float peak = 0.0f;
+        for (int k = spectrum->edges[b]; !silent && k < spectrum->edges[b + 1] && k < SPECTRUM_FFT_SIZE / 2; k++)
+        {
+            float power = spectrum->re[k] * spectrum->re[k] + spectrum->im[k] * spectrum->im[k];
+            if (power > peak) peak = power;
+        }
+        // -60 dB .. 0 dB onto 0 .. 1, from power so one sqrt is saved per bin
+        float level = peak > 0.0f ? (10.0f * log10f(peak * scale * scale) + 60.0f) / 60.0f : 0.0f;
+        if (level < 0.0f) level = 0.0f;
+        if (level > 1.0f) level = 1.0f;
+        float fallen = spectrum->levels[b] - SPECTRUM_FALL;
+        spectrum->levels[b] = level > fallen ? level : fallen > 0.0f ? fallen : 0.0f;
+    }
+
+    unsigned head = atomic_load_explicit(&spectrum->head, memory_order_relaxed);
+    unsigned tail = atomic_load_explicit(&spectrum->tail, memory_order_acquire);
+    if (head - tail == SPECTRUM_RING)
+    {
+        return;
+    }
+    SpectrumFrame *frame = &spectrum->ring[head % SPECTRUM_RING];
+    memcpy(frame->levels, spectrum->levels, count * sizeof(float));
+    frame->count = count;
+    atomic_store_explicit(&spectrum->head, head + 1, memory_order_release);
+    poke(spectrum);
+}
+
+// bars fall to the floor once when the audio stops, then the ui isn't woken up again
+static void go_quiet(Spectrum *spectrum, bool *quiet)
+{
+    if (*quiet)
+    {
+        return;
+    }
+    memset(spectrum->samples, 0, sizeof(spectrum->samples));
+    memset(spectrum->levels, 0, sizeof(spectrum->levels));
+    publish(spectrum, true);
+    *quiet = true;
+}
+
+static void *spectrum_main(void *arg)
+{
+    Spectrum *spectrum = arg;
+    const int hop = spectrum->rate / SPECTRUM_FPS;
+    const size_t want = (size_t)hop * 2 * sizeof(int16_t);
+    int16_t *pcm = malloc(want);
+    if (!pcm)
+    {
+        return NULL;
+    }
+    int fd = -1;
+    bool regular = false;
+    bool quiet = true;
+    struct timespec due;
+
+    while (!atomic_load(&spectrum->quit))
+    {
+        if (fd < 0)
+        {
+            // mpd makes the fifo when its output opens, which may be after us
+            fd = open(spectrum->path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+            struct stat st;
+            if (fd < 0 || fstat(fd, &st) < 0)
+            {
+                if (fd >= 0) close(fd);
+                fd = -1;
+                nap(SPECTRUM_NAP_MS);
+                continue;
+            }
+            regular = S_ISREG(st.st_mode);
+            clock_gettime(CLOCK_MONOTONIC, &due);
+        }
+
+        // one hop of interleaved stereo
+        size_t got = 0;
+        while (got < want && fd >= 0 && !atomic_load(&spectrum->quit))
+        {
+            struct pollfd pfd = { .fd = fd, .events = POLLIN };
+            if (!regular && poll(&pfd, 1, SPECTRUM_NAP_MS) == 0)
+            {
+                // paused or stopped, mpd writes nothing
+                go_quiet(spectrum, &quiet);
+                continue;
+            }
+            ssize_t n = read(fd, (char *)pcm + got, want - got);
+            if (n > 0)
+            {
+                got += n;
+            }
+            else if (n == 0)
+            {
+                // no writer on the fifo, or the end of a file that may still grow
+                go_quiet(spectrum, &quiet);
+                nap(SPECTRUM_NAP_MS);
+                clock_gettime(CLOCK_MONOTONIC, &due);
+            }
+            else if (errno != EAGAIN && errno != EINTR)
+            {
+                close(fd);
+                fd = -1;
+            }
+        }
+        if (got < want)
+        {
+            continue;
+        }
+
+        // slide the window along by one hop of mono
+        memmove(spectrum->samples, spectrum->samples + hop, (SPECTRUM_FFT_SIZE - hop) * sizeof(float));
+        float *tail = spectrum->samples + SPECTRUM_FFT_SIZE - hop;
+        for (int i = 0; i < hop; i++)
+        {
+            tail[i] = (pcm[2 * i] + pcm[2 * i + 1]) * (0.5f / 32768.0f);
+        }
+        quiet = false;
+        publish(spectrum, false);
+
+        // a file has no writer pacing it, play it back in real time
+        if (regular)
+        {
+            due.tv_nsec += 1000000000L / SPECTRUM_FPS;
+            if (due.tv_nsec >= 1000000000L)
+            {
+                due.tv_sec++;
+                due.tv_nsec -= 1000000000L;
+            }
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &due, NULL);
+        }
+    }
+    if (fd >= 0) close(fd);
+    free(pcm);
+    return NULL;
+}
+
+bool spectrum_start(Spectrum *spectrum, const char *path, int rate)
+{
+    memset(spectrum, 0, sizeof(Spectrum));
+    // at least a band's worth of samples per hop, and no hop longer than the window
+    if (rate < SPECTRUM_FPS * 2 || rate / SPECTRUM_FPS > SPECTRUM_FFT_SIZE)
+    {
+        return false;
+    }
+    spectrum->rate = rate;
+    spectrum->path = strdup(path);
+    if (!spectrum->path)
+    {
+        return false;
+    }
+    atomic_store(&spectrum->bands, 64);
+    build_tables(spectrum);
+
+    spectrum->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (spectrum->event_fd < 0)
+    {
+        free(spectrum->path);
+        return false;
+    }
+    if (pthread_create(&spectrum->thread, NULL, spectrum_main, spectrum) != 0)
+    {
+        close(spectrum->event_fd);
+        free(spectrum->path);
+        return false;
+    }
+    return true;
+}
+
+void spectrum_set_bands(Spectrum *spectrum, int bands)
+{
+    atomic_store_explicit(&spectrum->bands, bands, memory_order_relaxed);
+}
+
+bool spectrum_take(Spectrum *spectrum, SpectrumFrame *out)
+{
+    uint64_t count;
+    if (read(spectrum->event_fd, &count, sizeof(count)) < 0)
+    {
+        // EAGAIN, nothing was published since the last take
+    }
+    unsigned head = atomic_load_explicit(&spectrum->head, memory_order_acquire);
+    unsigned tail = atomic_load_explicit(&spectrum->tail, memory_order_relaxed);
+    if (head == tail)
+    {
+        return false;
+    }
+    // slots in [tail, head) are ours until tail moves, only the newest one is worth drawing
+    const SpectrumFrame *newest = &spectrum->ring[(head - 1) % SPECTRUM_RING];
+    memcpy(out->levels, newest->levels, newest->count * sizeof(float));
+    out->count = newest->count;
+    atomic_store_explicit(&spectrum->tail, head, memory_order_release);
+    return true;
+}
+
+void spectrum_stop(Spectrum *spectrum)
+{
+    atomic_store(&spectrum->quit, true);
+    pthread_join(spectrum->thread, NULL);
+    close(spectrum->event_fd);
+    free(spectrum->path);
+}
@@ -2,7 +2,12 @@
 #include <mpd/connection.h>
 #include <mpd/player.h>
 #include <mpd/response.h>
+#include <mpd/idle.h>
 #include <ncurses.h>
+#include <poll.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <sys/timerfd.h>
 
 /**
  * @brief Initializes all of necessary UI variables for TUI
@@ -22,18 +27,81 @@ void init_ui(const char *starting_directory, UI *ui)
 
   // directory setup
   ui->current_directory = strdup(starting_directory ? starting_directory : "");
-  ui->item_uris = malloc(MAX_ITEMS * sizeof(char*));
-  ui->item_types = malloc(MAX_ITEMS * sizeof(int));
-  // check for malloc failures
-  if (!ui->item_uris || !ui->item_types) 
-  {
-    fprintf(stderr, "Memory allocation failed\n");
-    endwin();
-    exit(1);
-  }
-  
-  ui->item_count = 0;
+  dir_cache_init(&ui->dir_cache);
+  library_init(&ui->library);
+  ui->library_worker = NULL;
+
+  // search, the index is built the first time it's needed
+  ui->show_search = false;
+  search_index_init(&ui->search_index, &ui->library);
+  memset(&ui->search_results, 0, sizeof(ui->search_results));
+  ui->search_query[0] = '\0';
+  ui->search_pos = 0;
+  ui->search_selected = 0;
+  ui->search_view.offset = 0;
+  ui->search_view.rows = 0;
+  ui->search_ms = 0;
+
+  // fuzzy jump, the finder is attached by main
+  ui->fuzzy = NULL;
+  ui->show_jump = false;
+  ui->jump_query[0] = '\0';
+  ui->jump_pos = 0;
+  ui->jump_count = 0;
+  ui->jump_scanned = 0;
+  ui->jump_selected = 0;
+  ui->jump_view.offset = 0;
+  ui->jump_view.rows = 0;
+  ui->dir_cache.library = &ui->library;
+  ui->listing = NULL;
   ui->selected_index = 0;
+  ui->dir_view.offset = 0;
+  ui->dir_view.rows = 0;
+  selection_init(&ui->marked);
+
+  // queue tab, filled in the first time it's shown
+  queue_list_init(&ui->queue);
+  ui->queue_selected = 0;
+  ui->queue_view.offset = 0;
+  ui->queue_view.rows = 0;
+
+  // mpd state, filled in by refresh_player_state()
+  ui->status = NULL;
+  ui->current_song = NULL;
+  ui->progress_ms = 0;
+  ui->progress_time.tv_sec = 0;
+  ui->progress_time.tv_nsec = 0;
+  ui->offline = false;
+  ui->cmd_worker = NULL;
+  ui->play_state = MPD_STATE_UNKNOWN;
+  ui->commands_in_flight = 0;
+  ui->status_deferred = false;
+  ui->command_failed = false;
+
+  // album art, the worker is attached by main
+  ui->art_worker = NULL;
+  art_cache_init(&ui->art_cache, (size_t)DEFAULT_ART_CACHE_BUDGET * 1024);
+  art_pack_open(&ui->art_pack, NULL, 0); // stays closed until main opens the real one
+  ui->art_mode = ART_MODE_ASCII;
+  ui->art_album = NULL;
+  ui->art_width = 0;
+  ui->art_height = 0;
+  ui->art_mtime = 0;
+  memset(&ui->art_transfer, 0, sizeof(ui->art_transfer));
+  ui->art_song_id = -1;
+  ui->prefetch_song_id = -1;
+  ui->art_loading = false;
+
+  // spectrum, the reader thread is attached by main
+  ui->spectrum = NULL;
+  ui->spectrum_frame.count = 0;
+  ui->spectrum_drawn.tv_sec = 0;
+  ui->spectrum_drawn.tv_nsec = 0;
+
+  // nothing drawn yet
+  ui->dirty = DIRTY_ALL;
+  ui->drawn_selected = 0;
+  ui->message[0] = '\0';
   
   // bools and where we are
   ui->show_directory_browser = false;
@@ -56,12 +124,17 @@ void clean_tui(UI* ui)
 {
   // after done looping clean up
   free(ui->current_directory);
-  for (int i = 0; i < ui->item_count; i++)
-  {
-    if (ui->item_uris[i]) free(ui->item_uris[i]);
-  }
-  free(ui->item_uris);
-  free(ui->item_types);
+  dir_cache_clear(&ui->dir_cache);
+  search_results_clear(&ui->search_results);
+  search_index_free(&ui->search_index);
+  library_free(&ui->library);
+  selection_clear(&ui->marked);
+  queue_list_free(&ui->queue);
+  if (ui->status) mpd_status_free(ui->status);
+  if (ui->current_song) mpd_song_free(ui->current_song);
+  art_cache_clear(&ui->art_cache);
+  art_pack_close(&ui->art_pack);
+  free(ui->art_album);
   delwin(ui->header);
   delwin(ui->main_area);
   delwin(ui->directory_selection);
@@ -71,21 +144,32 @@ void clean_tui(UI* ui)
 
 
 /**
- * @brief changes the time in UI headeralong with displaying which tab you're in
+ * @brief Redraws just the clock text in the header, the rest of the header is left alone
  * 
  * @param ui 
  */
-void update_header(UI* ui)
+void update_clock(UI* ui)
 {
   time_t now = time(NULL);
   struct tm *tm = localtime(&now);
   char time_str[20];
   strftime(time_str, sizeof(time_str), "%I:%M:%S", tm);
+  mvwprintw(ui->header, 1, 2, "Time: %s", time_str);
+  wnoutrefresh(ui->header);
+}
+
+/**
+ * @brief changes the time in UI headeralong with displaying which tab you're in
+ * 
+ * @param ui 
+ */
+void update_header(UI* ui)
+{
   werase(ui->header);
   
   // display time
   box(ui->header, 0, 0);
-  mvwprintw(ui->header, 1, 2, "Time: %s", time_str);
+  update_clock(ui);
 
   const char *tab_names[] = {"Home", "Directory", "Queue", "Help"};
   int x_pos = 2;
@@ -103,7 +187,45 @@ void update_header(UI* ui)
     }
     x_pos += strlen(tab_names[i]) + 3;
   }
-  wrefresh(ui->header);
+  wnoutrefresh(ui->header);
+}
+
+/**
+ * @brief Draws one entry of the listing on its row, padded so it fully replaces what was there
+ * 
+ * @param ui 
+ * @param listing 
+ * @param j index into the listing
+ */
+static void draw_browser_row(UI* ui, const DirListing *listing, int j)
+{
+  int row = j - ui->dir_view.offset + 2;
+  int width = ui->max_cols - 4;
+  if (j == ui->selected_index)
+  {
+    wattron(ui->main_area, A_REVERSE);
+  }
+  mvwprintw(ui->main_area, row, 2, "%-*.*s%s", width - 1, width - 1, listing->uris[j],
+            listing->types[j] == ENTRY_DIRECTORY ? "/" : " ");
+  if (j == ui->selected_index)
+  {
+    wattroff(ui->main_area, A_REVERSE);
+  }
+  // marks go in the gutter next to the border
+  mvwaddch(ui->main_area, row, 1, selection_contains(&ui->marked, listing->uris[j]) ? '*' : ' ');
+}
+
+/**
+ * @brief Draws the "n/total" counter in the browser title row, "n/loaded" while the listing still streams in
+ * 
+ * @param ui 
+ * @param listing 
+ */
+static void draw_browser_position(UI* ui, const DirListing *listing)
+{
+  mvwprintw(ui->main_area, 1, ui->max_cols - 28, "%-26s", "");
+  mvwprintw(ui->main_area, 1, ui->max_cols - 28, "%d/%d%s", ui->selected_index + 1, listing->count,
+            listing->streaming ? " loaded..." : "");
 }
 
 /**
@@ -114,93 +236,222 @@ void update_header(UI* ui)
  */
 void update_directory_browser(struct mpd_connection *conn, UI* ui)
 {
-    // reset everything (assume values are there)
-    for (int i = 0; i < MAX_ITEMS; i++) 
-    {
-      ui->item_uris[i] = NULL;
-      ui->item_types[i] = 0;
-    }
-
-    // free each item if theres a value
-    for (int i = 0; i < ui->item_count; i++)
+    // served from the cache unless we've never been here (or the database changed)
+    ui->listing = dir_cache_get(&ui->dir_cache, conn, ui->current_directory);
+    if (!ui->listing)
     {
-      if (ui->item_uris[i]) free(ui->item_uris[i]);
+      // a streamed listing failed on the worker's connection, not ours
+      mvwprintw(ui->main_area, 2, 2, "MPD error: %s",
+                ui->dir_cache.failed ? ui->dir_cache.error : mpd_connection_get_error_message(conn));
+      mpd_connection_clear_error(conn);
+      wnoutrefresh(ui->main_area);
+      return;
     }
-    ui->item_count = 0;
+    const DirListing *listing = ui->listing;
 
-    // if we cant receive the list of meta data something went wrong
-    if (!mpd_send_list_meta(conn, ui->current_directory[0] ? ui->current_directory : NULL))
+    // draw subdirectories and items, only the rows that fit between the borders
+    werase(ui->main_area);
+    box(ui->main_area, 0, 0);
+    ui->dir_view.rows = getmaxy(ui->main_area) - 3;
+    viewport_follow(&ui->dir_view, ui->selected_index, listing->count);
+    mvwprintw(ui->main_area, 1, 2, "Directory: %s", ui->current_directory);
+    
+    if (listing->count == 0)
     {
-      mvwprintw(ui->main_area, 2, 2, "Error sending MPD command");
-      wrefresh(ui->main_area);
-      return;
+      mvwprintw(ui->main_area, 2, 2, listing->streaming ? "Loading..." : "No items found");
     }
-
-    // detect directory and songs, map these strings to item_uris and associate its type
-    struct mpd_entity *entity;
-    while ((entity = mpd_recv_entity(conn)) != NULL && ui->item_count < MAX_ITEMS)
+    else
     {
-      if (mpd_entity_get_type(entity) == MPD_ENTITY_TYPE_DIRECTORY)
-      {
-        const struct mpd_directory *dir = mpd_entity_get_directory(entity);
-        ui->item_uris[ui->item_count] = strdup(mpd_directory_get_path(dir));
-        ui->item_types[ui->item_count] = 0;
-      }
-      else if (mpd_entity_get_type(entity) == MPD_ENTITY_TYPE_SONG)
+      draw_browser_position(ui, listing);
+      int end = viewport_end(&ui->dir_view, listing->count);
+      for (int j = ui->dir_view.offset; j < end; j++)
       {
-        const struct mpd_song *song = mpd_entity_get_song(entity);
-        ui->item_uris[ui->item_count] = strdup(mpd_song_get_uri(song));
-        ui->item_types[ui->item_count] = 1;
+        draw_browser_row(ui, listing, j);
       }
-      mpd_entity_free(entity);
-      ui->item_count++;
     }
+    ui->drawn_selected = ui->selected_index;
+    wnoutrefresh(ui->main_area);
+}
+
+/**
+ * @brief Moves the highlight in the browser by repainting only the old and new rows
+ *        Falls back to a full repaint when the move scrolled the viewport
+ * 
+ * @param conn 
+ * @param ui 
+ */
+void update_browser_selection(struct mpd_connection *conn, UI* ui)
+{
+  const DirListing *listing = ui->listing;
+  int offset = ui->dir_view.offset;
+  if (listing)
+  {
+    viewport_follow(&ui->dir_view, ui->selected_index, listing->count);
+  }
+  if (!listing || ui->dir_view.offset != offset || ui->drawn_selected >= listing->count)
+  {
+    update_directory_browser(conn, ui);
+    return;
+  }
+
+  draw_browser_row(ui, listing, ui->drawn_selected);
+  draw_browser_row(ui, listing, ui->selected_index);
+  draw_browser_position(ui, listing);
+  ui->drawn_selected = ui->selected_index;
+  wnoutrefresh(ui->main_area);
+}
+
+/**
+ * @brief Draws the search query and the results that fit, labels are only made for visible rows
+ *
+ * @param ui
+ */
+void update_search_view(UI* ui)
+{
+  const SearchResults *results = &ui->search_results;
+  mvwprintw(ui->main_area, 1, 2, "Search: %s_", ui->search_query);
+  if (results->from_server)
+  {
+    mvwprintw(ui->main_area, 1, ui->max_cols - 30, "%d results from mpd", results->count);
+  }
+  else
+  {
+    mvwprintw(ui->main_area, 1, ui->max_cols - 30, "%d results in %.2f ms", results->count, ui->search_ms);
+  }
 
-    // err handling 
-    if (mpd_connection_get_error(conn) != MPD_ERROR_SUCCESS)
+  if (results->count == 0)
+  {
+    mvwprintw(ui->main_area, 2, 2, ui->search_query[0] ? "No matches" : "artist: album: title: year: or any words");
+    wnoutrefresh(ui->main_area);
+    return;
+  }
+  ui->search_view.rows = getmaxy(ui->main_area) - 3;
+  viewport_follow(&ui->search_view, ui->search_selected, results->count);
+  int end = viewport_end(&ui->search_view, results->count);
+  int width = ui->max_cols - 4;
+  char label[512];
+  for (int i = ui->search_view.offset; i < end; i++)
+  {
+    search_result_label(results, &ui->library, i, label, sizeof(label));
+    if (i == ui->search_selected)
     {
-      mvwprintw(ui->main_area, 2, 2, "MPD error: %s", mpd_connection_get_error_message(conn));
-      mpd_response_finish(conn);
-      wrefresh(ui->main_area);
-      return;
+      wattron(ui->main_area, A_REVERSE);
+    }
+    mvwprintw(ui->main_area, i - ui->search_view.offset + 2, 2, "%-*.*s", width, width, label);
+    if (i == ui->search_selected)
+    {
+      wattroff(ui->main_area, A_REVERSE);
     }
+  }
+  wnoutrefresh(ui->main_area);
+}
 
-    mpd_response_finish(conn);
+/**
+ * @brief Draws the jump pattern and the best matches so far, with how much of the library was scanned
+ *
+ * @param ui
+ */
+void update_jump_view(UI* ui)
+{
+  mvwprintw(ui->main_area, 1, 2, "Jump to: %s_", ui->jump_query);
+  uint32_t total = ui->fuzzy ? ui->fuzzy->candidate_count : 0;
+  if (ui->jump_query[0] && total > 0)
+  {
+    mvwprintw(ui->main_area, 1, ui->max_cols - 30, "%d matches, %u/%u", ui->jump_count, ui->jump_scanned, total);
+  }
 
-    // draw subdirectories and items
-    werase(ui->main_area);
-    box(ui->main_area, 0, 0);
-    mvwprintw(ui->main_area, 1, 2, "Directory: %s", ui->current_directory);
-    
-    if (ui->item_count == 0)
+  if (ui->jump_count == 0)
+  {
+    const char *hint = !ui->library.loaded ? "Library not loaded yet"
+                     : !ui->jump_query[0] ? "Type part of a folder or song path"
+                     : ui->jump_scanned < total ? "Searching..." : "No matches";
+    mvwprintw(ui->main_area, 2, 2, "%s", hint);
+    wnoutrefresh(ui->main_area);
+    return;
+  }
+  ui->jump_view.rows = getmaxy(ui->main_area) - 3;
+  viewport_follow(&ui->jump_view, ui->jump_selected, ui->jump_count);
+  int end = viewport_end(&ui->jump_view, ui->jump_count);
+  int width = ui->max_cols - 4;
+  for (int i = ui->jump_view.offset; i < end; i++)
+  {
+    bool is_dir;
+    const char *path = fuzzy_candidate(ui->fuzzy, ui->jump_results[i].candidate, &is_dir);
+    if (i == ui->jump_selected)
     {
-      mvwprintw(ui->main_area, 2, 2, "No items found");
+      wattron(ui->main_area, A_REVERSE);
     }
-    else
+    mvwprintw(ui->main_area, i - ui->jump_view.offset + 2, 2, "%-*.*s%s", width - 1, width - 1, path, is_dir ? "/" : " ");
+    if (i == ui->jump_selected)
     {
-      for (int j = 0; j < ui->item_count; j++)
-      {
-        if (j == ui->selected_index)
-        {
-          wattron(ui->main_area, A_REVERSE);
-        }
-        if (ui->item_types[j] == 0)
-        {
-          mvwprintw(ui->main_area, j + 2, 2, "%s/", ui->item_uris[j]);
-        }
-        else
-        {
-          mvwprintw(ui->main_area, j + 2, 2, "%s", ui->item_uris[j]);
-        }
-        if (j == ui->selected_index)
-        {
-          wattroff(ui->main_area, A_REVERSE);
-        }
-      }
+      wattroff(ui->main_area, A_REVERSE);
     }
-    wrefresh(ui->main_area);
+  }
+  wnoutrefresh(ui->main_area);
 }
 
+/**
+ * @brief Draws the queue tab
+ *        Only positions that changed since the last visit are asked for, and titles
+ *        are fetched for the rows on screen, so a long queue is never pulled whole
+ *
+ * @param conn
+ * @param ui
+ */
+void update_queue_view(struct mpd_connection *conn, UI* ui)
+{
+  QueueList *queue = &ui->queue;
+  if (ui->status && !queue_list_sync(queue, conn, mpd_status_get_queue_version(ui->status),
+                                     (int)mpd_status_get_queue_length(ui->status)))
+  {
+    mvwprintw(ui->main_area, 2, 2, "MPD error: %s", mpd_connection_get_error_message(conn));
+    mpd_connection_clear_error(conn);
+    wnoutrefresh(ui->main_area);
+    return;
+  }
+
+  if (ui->queue_selected >= queue->length) ui->queue_selected = queue->length - 1;
+  if (ui->queue_selected < 0) ui->queue_selected = 0;
+  ui->queue_view.rows = getmaxy(ui->main_area) - 3;
+  viewport_follow(&ui->queue_view, ui->queue_selected, queue->length);
+  int end = viewport_end(&ui->queue_view, queue->length);
+  if (!queue_list_load(queue, conn, ui->queue_view.offset, end))
+  {
+    mpd_connection_clear_error(conn);
+  }
+
+  mvwprintw(ui->main_area, 1, 2, "Queue");
+  if (queue->length == 0)
+  {
+    mvwprintw(ui->main_area, 2, 2, "Queue is empty");
+    wnoutrefresh(ui->main_area);
+    return;
+  }
+  mvwprintw(ui->main_area, 1, ui->max_cols - 20, "%d/%d", ui->queue_selected + 1, queue->length);
+
+  int playing = ui->status ? mpd_status_get_song_pos(ui->status) : -1;
+  int width = ui->max_cols - 4;
+  for (int pos = ui->queue_view.offset; pos < end; pos++)
+  {
+    int row = pos - ui->queue_view.offset + 2;
+    const char *title = queue_list_title(queue, pos);
+    if (pos == ui->queue_selected)
+    {
+      wattron(ui->main_area, A_REVERSE);
+    }
+    mvwprintw(ui->main_area, row, 2, "%-*.*s", width, width, title ? title : "...");
+    if (pos == ui->queue_selected)
+    {
+      wattroff(ui->main_area, A_REVERSE);
+    }
+    // current song goes in the gutter, like marks in the browser
+    if (pos == playing)
+    {
+      mvwaddch(ui->main_area, row, 1, '>');
+    }
+  }
+  wnoutrefresh(ui->main_area);
+}
 
 /**
  * @brief simple wrapper func to update dir selection
@@ -213,7 +464,7 @@ void update_directory_selection(UI* ui)
     box(ui->directory_selection, 0, 0);
     mvwprintw(ui->directory_selection, 1, 2, "Music Directory: %s", ui->input_buffer);
     mvwprintw(ui->directory_selection, 1, ui->max_cols - 30, "[Enter to save, Esc to cancel]");
-    wrefresh(ui->directory_selection);
+    wnoutrefresh(ui->directory_selection);
 }
 
 /**
@@ -234,7 +485,22 @@ void help_screen(UI *ui)
     mvwprintw(ui->main_area, 7, 2, "<UP> <DOWN>    | Scrolls up and down a list");
     mvwprintw(ui->main_area, 8, 2, "U              | Goes up a directory]");
     mvwprintw(ui->main_area, 9, 2, "<ENTER>        | Goes down a directory and adds song to que");
-    wrefresh(ui->main_area);
+    mvwprintw(ui->main_area, 10, 2, "<PGUP> <PGDN>  | Scrolls a page up or down");
+    mvwprintw(ui->main_area, 11, 2, "<HOME> <END>   | Jumps to the first or last entry");
+    mvwprintw(ui->main_area, 12, 2, "Shift+<letter> | Jumps to the first entry starting with letter");
+    mvwprintw(ui->main_area, 13, 2, "<SPACE> * C    | Mark entry, mark all here, clear marks");
+    mvwprintw(ui->main_area, 14, 2, "A              | Adds marked entries (or this one, folders recursively) to que");
+    mvwprintw(ui->main_area, 15, 2, "/              | Search (artist: album: title: year: or any words), <ENTER> adds, <ESC> closes");
+    mvwprintw(ui->main_area, 16, 2, "j              | Fuzzy jump to any folder or song, <ENTER> goes there, <ESC> closes");
+    mvwprintw(ui->main_area, 17, 2, "Queue Help:");
+    mvwprintw(ui->main_area, 18, 2, "<ENTER>        | Plays the highlighted song (same scrolling keys as above)");
+    mvwprintw(ui->main_area, 20, 2, "Album art cache: %lu hits, %lu misses, %lu evictions, %zu/%zu KiB",
+              ui->art_cache.hits, ui->art_cache.misses, ui->art_cache.evictions,
+              ui->art_cache.bytes / 1024, ui->art_cache.budget / 1024);
+    mvwprintw(ui->main_area, 21, 2, "Last cover: %zu KiB in %u round trips of up to %zu KiB%s",
+              ui->art_transfer.bytes / 1024, ui->art_transfer.round_trips, ui->art_transfer.chunk_size / 1024,
+              ui->art_transfer.local ? " (local cover file)" : ui->art_transfer.from_folder ? " (cover file)" : "");
+    wnoutrefresh(ui->main_area);
 }
 
 /**
@@ -247,7 +513,15 @@ void update_main_area(struct mpd_connection *conn, UI* ui)
 {
   werase(ui->main_area);
   box(ui->main_area, 0, 0);
-  if (ui->show_directory_browser) 
+  if (ui->show_search)
+  {
+    update_search_view(ui);
+  }
+  else if (ui->show_jump)
+  {
+    update_jump_view(ui);
+  }
+  else if (ui->show_directory_browser) 
   {
     update_directory_browser(conn, ui);
   }
@@ -255,48 +529,41 @@ void update_main_area(struct mpd_connection *conn, UI* ui)
   {
     help_screen(ui);
   }
+  else if (ui->current_tab == queue)
+  {
+    update_queue_view(conn, ui);
+  }
   else 
   {
     mvwprintw(ui->main_area, 1, 2, "Orpeus - C-based Music Player");
     
-    // Fetch and display album art as ASCII
-    // const char *temp_file = "/tmp/orpeus_album_art.jpg";
-    // if (fetch_album_art(conn, temp_file) == 0) 
-    // {
-    //   // Convert JPEG to ASCII art
-    //   int ascii_width = ui->max_cols - 4; // Fit within window borders
-    //   int max_height = ui->max_rows - 7; // Leave space for text and borders
-    //   AsciiArt *art = jpeg_to_ascii(temp_file, ascii_width, max_height);
-      
-    //   if (art && art->num_lines > 0) 
-    //   {
-    //     // Display ASCII art centered in the main area
-    //     int start_y = 3; // Start below the title
-    //     int start_x = (ui->max_cols - art->max_width) / 2; // Center horizontally
-    //     for (int i = 0; i < art->num_lines && start_y + i < ui->max_rows - 4; i++) 
-    //     {
-    //       mvwprintw(ui->main_area, start_y + i, start_x, "%s", art->lines[i]);
-    //     }
-    //     ascii_art_free(art);
-    //   } 
-    //   else 
-    //   {
-    //     mvwprintw(ui->main_area, 3, 2, "No album art available or conversion failed");
-    //   }
-
-    //   // Clean up temporary file
-    //   unlink(temp_file);
-    // } 
-    // else
-    // {
-    //   mvwprintw(ui->main_area, 3, 2, "Failed to fetch album art");
-    // }
-
-    // Display current song info
-    struct mpd_song *song = mpd_run_current_song(conn);
+    // album art comes from the worker thread, we only draw what it already converted
+    int info_row = getmaxy(ui->main_area) - 4;
+    const AsciiArt *art = ui->art_album ? art_cache_peek(&ui->art_cache, ui->art_album, ui->art_width, ui->art_height, ui->art_mode) : NULL;
+    if (art && art->num_lines > 0) 
+    {
+      // Display ASCII art centered in the main area
+      int start_y = 3; // Start below the title
+      int start_x = (ui->max_cols - art->max_width) / 2; // Center horizontally
+      for (int i = 0; i < art->num_lines && start_y + i < info_row - 1; i++) 
+      {
+        mvwprintw(ui->main_area, start_y + i, start_x, "%s", art->lines[i]);
+      }
+    } 
+    else if (ui->art_loading)
+    {
+      mvwprintw(ui->main_area, 3, 2, "Loading album art...");
+    }
+    else if (ui->current_song)
+    {
+      mvwprintw(ui->main_area, 3, 2, "No album art available");
+    }
+
+    // Display current song info (cached, refreshed on player events)
+    const struct mpd_song *song = ui->current_song;
     if (song == NULL) 
     {
-      printf("No song currently playing.\n");
+      mvwprintw(ui->main_area, info_row, 2, "No song currently playing.");
     } 
     else
     {
@@ -305,461 +572,1604 @@ void update_main_area(struct mpd_connection *conn, UI* ui)
       const char *title = mpd_song_get_tag(song, MPD_TAG_TITLE, 0);
       const char *album = mpd_song_get_tag(song, MPD_TAG_ALBUM, 0);
 
-      mvwprintw(ui->main_area, 15, 2, "Artist: %s\n", artist ? artist : "Unknown");
-      mvwprintw(ui->main_area, 16, 2, "Title: %s\n", title ? title : "Unknown");
-      mvwprintw(ui->main_area, 17, 2, "Album: %s\n", album ? album : "Unknown");
-
-      mpd_song_free(song);
+      mvwprintw(ui->main_area, info_row, 2, "Artist: %s", artist ? artist : "Unknown");
+      mvwprintw(ui->main_area, info_row + 1, 2, "Title: %s", title ? title : "Unknown");
+      mvwprintw(ui->main_area, info_row + 2, 2, "Album: %s", album ? album : "Unknown");
     } 
 
   }
-  wrefresh(ui->main_area);
+  wnoutrefresh(ui->main_area);
 }
 
 /**
- * @brief Update footer with state of mpd
+ * @brief Length of the current song, the tag's if it has one else what the status says; 0 for streams
  * 
- * @param conn 
  * @param ui 
- * @return update 
+ * @return unsigned milliseconds
  */
-void update_footer(struct mpd_connection *conn, UI* ui)
+static unsigned song_length_ms(const UI* ui)
 {
-  werase(ui->footer);
-  box(ui->footer, 0, 0);
+  unsigned total = ui->current_song ? mpd_song_get_duration_ms(ui->current_song) : 0;
+  if (!total && ui->status) total = mpd_status_get_total_time(ui->status) * 1000;
+  return total;
+}
 
-  if (!mpd_send_status(conn))
+/**
+ * @brief Length of the song the progress line is shown for, 0 when there's no line to draw
+ * 
+ * @param ui 
+ * @return unsigned milliseconds
+ */
+static unsigned song_duration_ms(const UI* ui)
+{
+  if (!ui->status || ui->play_state == MPD_STATE_STOP || ui->play_state == MPD_STATE_UNKNOWN)
   {
-    mvwprintw(ui->footer, 1, 2, "MPD command error");
-    wrefresh(ui->footer);
-    return;
+    return 0;
   }
+  return song_length_ms(ui);
+}
 
-  struct mpd_status *status = mpd_recv_status(conn);
-  if (status)
+/**
+ * @brief Elapsed time of the current song: the last status plus however long we've been playing since
+ * 
+ * @param ui 
+ * @return unsigned milliseconds, never past the song's end
+ */
+static unsigned current_elapsed_ms(const UI* ui)
+{
+  unsigned elapsed = ui->progress_ms;
+  if (ui->play_state == MPD_STATE_PLAY)
   {
-    switch (mpd_status_get_state(status))
-    {
-      case MPD_STATE_PLAY:
-        // visualizer movement
-        static int pos = 0;
-        pos = (pos + 1) % (ui->max_cols - 4);                        
-        mvwprintw(ui->footer, 1, 2 + pos, "|");
-        break;
-      case MPD_STATE_PAUSE:
-        mvwprintw(ui->footer, 1, 2, "Paused");
-        break;
-      case MPD_STATE_STOP:
-        mvwprintw(ui->footer, 1, 2, "Stopped");
-        break;
-      default:
-        mvwprintw(ui->footer, 1, 2, "Unknown (default switch)");
-        break;
-    }
-    mpd_status_free(status);
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    long long since = (now.tv_sec - ui->progress_time.tv_sec) * 1000LL + (now.tv_nsec - ui->progress_time.tv_nsec) / 1000000;
+    elapsed += since > 0 ? (unsigned)since : 0;
+  }
+  unsigned total = song_length_ms(ui);
+  return total && elapsed > total ? total : elapsed;
+}
+
+/**
+ * @brief Restarts the interpolation from elapsed as of now, before play_state changes or when mpd told us where we are
+ * 
+ * @param ui 
+ * @param elapsed 
+ */
+static void set_progress(UI* ui, unsigned elapsed)
+{
+  ui->progress_ms = elapsed;
+  clock_gettime(CLOCK_MONOTONIC, &ui->progress_time);
+}
+
+/**
+ * @brief Formats ms as m:ss, or h:mm:ss for long ones
+ * 
+ * @param ms 
+ * @param buf 
+ * @param size 
+ */
+static void format_time(unsigned ms, char *buf, size_t size)
+{
+  unsigned seconds = ms / 1000;
+  if (seconds >= 3600)
+  {
+    snprintf(buf, size, "%u:%02u:%02u", seconds / 3600, seconds / 60 % 60, seconds % 60);
   }
   else
   {
-    mvwprintw(ui->footer, 1, 2, "No status");
+    snprintf(buf, size, "%u:%02u", seconds / 60, seconds % 60);
   }
+}
+
+/**
+ * @brief Lays out the progress line: " elapsed / total " then the bar up to the corner
+ * 
+ * @param ui 
+ * @param elapsed 
+ * @param total 
+ * @param text gets the times
+ * @param size 
+ * @param bar_x column the bar starts at
+ * @return int bar width in columns
+ */
+static int progress_layout(const UI* ui, unsigned elapsed, unsigned total, char *text, size_t size, int *bar_x)
+{
+  char now[16], end[16];
+  format_time(elapsed, now, sizeof(now));
+  format_time(total, end, sizeof(end));
+  snprintf(text, size, " %s / %s ", now, end);
+  *bar_x = 2 + strlen(text);
+  return ui->max_cols - 2 - *bar_x;
+}
 
-  if (mpd_connection_get_error(conn) != MPD_ERROR_SUCCESS)
+/**
+ * @brief Draws elapsed / total and a bar into the footer's top border, the border shows through as the rest of the song
+ * 
+ * @param ui 
+ */
+static void draw_progress(UI* ui)
+{
+  unsigned total = song_duration_ms(ui);
+  if (total == 0)
+  {
+    return;
+  }
+  unsigned elapsed = current_elapsed_ms(ui);
+  char text[48];
+  int bar_x;
+  int width = progress_layout(ui, elapsed, total, text, sizeof(text), &bar_x);
+  if (width < 0)
+  {
+    // too narrow for the times, the border stays as it is
+    return;
+  }
+  mvwprintw(ui->footer, 0, 2, "%s", text);
+  if (width > 0)
   {
-    mvwprintw(ui->footer, 1, 2, "MPD error: %s", mpd_connection_get_error_message(conn));
+    mvwhline(ui->footer, 0, bar_x, '=', (int)((unsigned long long)width * elapsed / total));
   }
+}
 
-  mpd_response_finish(conn);
-  wrefresh(ui->footer);
+/**
+ * @brief How long until the progress line would look different, the next second or bar column
+ * 
+ * @param ui 
+ * @return long milliseconds, -1 if it won't change on its own (paused, stopped, streams)
+ */
+static long progress_next_change_ms(const UI* ui)
+{
+  unsigned total = song_duration_ms(ui);
+  if (total == 0 || ui->play_state != MPD_STATE_PLAY)
+  {
+    return -1;
+  }
+  unsigned elapsed = current_elapsed_ms(ui);
+  if (elapsed >= total)
+  {
+    return -1;
+  }
+  long next = 1000 - elapsed % 1000;
+  char text[48];
+  int bar_x;
+  int width = progress_layout(ui, elapsed, total, text, sizeof(text), &bar_x);
+  if (width > 0)
+  {
+    // first ms at which one more column is filled
+    unsigned long long column = (unsigned long long)width * elapsed / total + 1;
+    long to_column = (long)((column * total + width - 1) / width - elapsed);
+    if (to_column > 0 && to_column < next) next = to_column;
+  }
+  return next;
 }
 
 /**
- * @brief Main tui loop that gets user input, default is main screen but user can switch screens
- *        This is what is called by main 
- * @param conn 
+ * @brief Arms progress_fd for the progress line's next change, or disarms it when nothing moves
+ *        The elapsed time is interpolated locally, so this costs mpd nothing
  * @param ui 
+ * @param progress_fd one shot timerfd
  */
-void run_tui(struct mpd_connection *conn, UI* ui) 
+static void arm_progress_timer(const UI* ui, int progress_fd)
 {
-  int current_win = 0; 
-  int ch;
-  timeout(500);
-  
-  // while we haven't quit
-  while ((ch = getch()) != 'q') 
+  struct itimerspec when = { 0 };
+  long ms = ui->offline ? -1 : progress_next_change_ms(ui);
+  if (ms >= 0)
   {
-    // looping window tabs
-    if (ch == KEY_LEFT)
-    {
-      if (current_win == 0)
-      {
-        current_win = 3;
-      }
-      else 
-      {
-        current_win -= 1;
-      }
-    }
-    if (ch == KEY_RIGHT)
-    {
-      if (current_win == 3)
-      {
-        current_win = 0;
-      }
-      else
-      {
-        current_win += 1;
-      }
-    }
+    // a millisecond late so the redraw lands past the boundary, not just before it
+    ms++;
+    when.it_value.tv_sec = ms / 1000;
+    when.it_value.tv_nsec = (ms % 1000) * 1000000L;
+  }
+  timerfd_settime(progress_fd, 0, &when, NULL);
+}
 
-    // play / pause status
-    if (ch == 'p')
-    {
-      if (!mpd_send_status(conn))
-      {
-        mvwprintw(ui->main_area, ui->item_count + 2, 2, "Failed to get status: %s", 
-        mpd_connection_get_error_message(conn));
-        wrefresh(ui->main_area);
-        mpd_response_finish(conn);
+/**
+ * @brief Draws the newest spectrum frame across the footer, one column per band, louder is denser
+ *
+ * @param ui
+ */
+static void draw_spectrum(UI* ui)
+{
+  static const char ramp[] = " .:-=+*#%@";
+  int width = ui->max_cols - 4;
+  // the thread builds the next frames for this width
+  spectrum_set_bands(ui->spectrum, width);
+  const SpectrumFrame *frame = &ui->spectrum_frame;
+  if (frame->count == 0)
+  {
+    return;
+  }
+  for (int x = 0; x < width; x++)
+  {
+    // frames made before a resize get stretched until the new width comes through
+    float level = frame->levels[(long)x * frame->count / width];
+    mvwaddch(ui->footer, 1, 2 + x, ramp[(int)(level * (sizeof(ramp) - 2) + 0.5f)]);
+  }
+}
+
+/**
+ * @brief Update footer with the last status mpd sent us
+ * 
+ * @param ui 
+ * @return update 
+ */
+void update_footer(UI* ui)
+{
+  werase(ui->footer);
+  box(ui->footer, 0, 0);
+
+  if (ui->offline)
+  {
+    mvwprintw(ui->footer, 1, 2, "Reconnecting to mpd...");
+  }
+  else if (ui->status)
+  {
+    switch (ui->play_state)
+    {
+      case MPD_STATE_PLAY:
+        if (ui->spectrum)
+        {
+          draw_spectrum(ui);
+          break;
+        }
+        // visualizer movement, a step per second played however often the footer is redrawn
+        mvwprintw(ui->footer, 1, 2 + (int)(current_elapsed_ms(ui) / 1000 % (ui->max_cols - 4)), "|");
+        break;
+      case MPD_STATE_PAUSE:
+        mvwprintw(ui->footer, 1, 2, "Paused");
+        break;
+      case MPD_STATE_STOP:
+        mvwprintw(ui->footer, 1, 2, "Stopped");
+        break;
+      default:
+        mvwprintw(ui->footer, 1, 2, "Unknown (default switch)");
         break;
+    }
+  }
+  else
+  {
+    mvwprintw(ui->footer, 1, 2, "No status");
+  }
+  if (!ui->offline)
+  {
+    draw_progress(ui);
+  }
+
+  // last command result, right aligned, flagged while mpd is rejecting commands
+  if (ui->message[0])
+  {
+    int len = strlen(ui->message) + (ui->command_failed ? 4 : 0);
+    int x = ui->max_cols - len - 2;
+    mvwprintw(ui->footer, 1, x > 2 ? x : 2, "%s%.*s", ui->command_failed ? "[!] " : "", ui->max_cols - 8, ui->message);
+  }
+
+  wnoutrefresh(ui->footer);
+}
+
+/**
+ * @brief Marks screen regions that have to be repainted on the next ui_render()
+ * 
+ * @param ui 
+ * @param regions DIRTY_* flags
+ */
+void ui_mark_dirty(UI* ui, unsigned regions)
+{
+  ui->dirty |= regions;
+}
+
+/**
+ * @brief Shows a short message in the footer (printf style)
+ * 
+ * @param ui 
+ * @param fmt 
+ */
+void ui_set_message(UI* ui, const char *fmt, ...)
+{
+  va_list args;
+  va_start(args, fmt);
+  vsnprintf(ui->message, sizeof(ui->message), fmt, args);
+  va_end(args);
+  ui_mark_dirty(ui, DIRTY_FOOTER);
+}
+
+/**
+ * @brief Repaints only the dirty regions and pushes them to the terminal with one doupdate()
+ * 
+ * @param conn 
+ * @param ui 
+ */
+void ui_render(struct mpd_connection *conn, UI* ui)
+{
+  if (!ui->dirty)
+  {
+    return;
+  }
+
+  if (ui->dirty & DIRTY_TABS)
+  {
+    update_header(ui);
+  }
+  else if (ui->dirty & DIRTY_CLOCK)
+  {
+    update_clock(ui);
+  }
+
+  if (ui->dirty & DIRTY_MAIN)
+  {
+    update_main_area(conn, ui);
+  }
+  else if ((ui->dirty & DIRTY_SELECTION) && ui->show_directory_browser)
+  {
+    update_browser_selection(conn, ui);
+  }
+
+  if ((ui->dirty & DIRTY_INPUT) && ui->show_directory_selection)
+  {
+    update_directory_selection(ui);
+  }
+
+  if (ui->dirty & DIRTY_FOOTER)
+  {
+    update_footer(ui);
+  }
+
+  ui->dirty = 0;
+  doupdate();
+}
+
+/**
+ * @brief Refreshes the cached status and current song, both in a single command list
+ *        Only called when mpd tells us something changed (or on startup)
+ * 
+ * @param conn 
+ * @param ui 
+ */
+void refresh_player_state(struct mpd_connection *conn, UI* ui)
+{
+  if (ui->status) mpd_status_free(ui->status);
+  if (ui->current_song) mpd_song_free(ui->current_song);
+  ui->status = NULL;
+  ui->current_song = NULL;
+
+  if (!mpd_command_list_begin(conn, true) ||
+      !mpd_send_status(conn) ||
+      !mpd_send_current_song(conn) ||
+      !mpd_command_list_end(conn))
+  {
+    mpd_response_finish(conn);
+    return;
+  }
+
+  ui->status = mpd_recv_status(conn);
+  if (ui->status && mpd_response_next(conn))
+  {
+    ui->current_song = mpd_recv_song(conn);
+  }
+  mpd_response_finish(conn);
+
+  // while our own commands are in flight this may predate them, keep the optimistic state for now
+  ui->status_deferred = ui->status && ui->commands_in_flight > 0;
+  if (ui->status && ui->commands_in_flight == 0)
+  {
+    ui->play_state = mpd_status_get_state(ui->status);
+  }
+  // the only place progress is taken from mpd, between player events it's interpolated
+  if (ui->status)
+  {
+    set_progress(ui, mpd_status_get_elapsed_ms(ui->status));
+  }
+}
+
+/**
+ * @brief Finds song's cover in the memory cache or, failing that, the on-disk pack
+ *        Pack hits are copied into the memory cache
+ * 
+ * @param ui 
+ * @param album 
+ * @param mtime 
+ * @return true if the cover (or the knowledge that there is none) is now in the memory cache
+ */
+static bool art_cached(UI* ui, const char *album, time_t mtime)
+{
+  AsciiArt *stored;
+  if (art_cache_contains(&ui->art_cache, album, ui->art_width, ui->art_height, ui->art_mode))
+  {
+    return true;
+  }
+  // rendered in an earlier run and the song hasn't changed since; while the art worker is
+  // writing the pack this is a miss and the worker looks again
+  if (art_pack_try_lookup(&ui->art_pack, album, ui->art_width, ui->art_height, ui->art_mode, mtime, &stored))
+  {
+    art_cache_insert(&ui->art_cache, album, ui->art_width, ui->art_height, ui->art_mode, stored);
+    return true;
+  }
+  return false;
+}
+
+/**
+ * @brief Points the home tab at the current song's cover when the song changed
+ *        Songs from an album we already rendered at this size (or prefetched) come straight
+ *        from the cache, otherwise the art worker is asked and any fetch still running is abandoned
+ * 
+ * @param ui 
+ */
+static void show_current_art(UI* ui)
+{
+  int song_id = ui->current_song ? (int)mpd_song_get_id(ui->current_song) : -1;
+  if (song_id == ui->art_song_id)
+  {
+    return;
+  }
+
+  ui->art_song_id = song_id;
+  free(ui->art_album);
+  ui->art_album = NULL;
+  ui->art_loading = false;
+  if (!ui->current_song)
+  {
+    return;
+  }
+
+  ui->art_album = art_cache_album(mpd_song_get_uri(ui->current_song));
+  ui->art_width = ui->max_cols - 4; // Fit within window borders
+  ui->art_height = getmaxy(ui->main_area) - 8; // Leave space for title, song info and borders
+  ui->art_mtime = mpd_song_get_last_modified(ui->current_song);
+  if (!ui->art_album)
+  {
+    return;
+  }
+  const AsciiArt *art;
+  if (art_cache_lookup(&ui->art_cache, ui->art_album, ui->art_width, ui->art_height, ui->art_mode, &art) ||
+      art_cached(ui, ui->art_album, ui->art_mtime))
+  {
+    art_cache_pin(&ui->art_cache, ui->art_album, ui->art_width, ui->art_height, ui->art_mode);
+    return;
+  }
+  if (ui->art_worker)
+  {
+    art_worker_request(ui->art_worker, mpd_song_get_uri(ui->current_song), ui->art_mtime, ui->art_width, ui->art_height, ui->art_mode);
+    ui->art_loading = true;
+  }
+}
+
+/**
+ * @brief Has the art worker render the next song's cover in the background, so the
+ *        track change can show it right away
+ * 
+ * @param conn 
+ * @param ui 
+ */
+static void prefetch_next_art(struct mpd_connection *conn, UI* ui)
+{
+  int next_id = ui->status ? mpd_status_get_next_song_id(ui->status) : -1;
+  if (next_id == ui->prefetch_song_id)
+  {
+    return;
+  }
+  ui->prefetch_song_id = next_id;
+  if (next_id < 0 || !ui->art_worker || !ui->current_song)
+  {
+    return;
+  }
+
+  struct mpd_song *next = mpd_run_get_queue_song_id(conn, (unsigned)next_id);
+  if (!next)
+  {
+    mpd_connection_clear_error(conn);
+    return;
+  }
+  char *album = art_cache_album(mpd_song_get_uri(next));
+  time_t mtime = mpd_song_get_last_modified(next);
+  // next track of the same album, or already known
+  if (album && !art_cached(ui, album, mtime))
+  {
+    art_worker_prefetch(ui->art_worker, mpd_song_get_uri(next), mtime, ui->art_width, ui->art_height, ui->art_mode);
+  }
+  free(album);
+  mpd_song_free(next);
+}
+
+/**
+ * @brief Brings the current song's cover on screen and prefetches the next one's
+ * 
+ * @param conn 
+ * @param ui 
+ */
+void request_album_art(struct mpd_connection *conn, UI* ui)
+{
+  show_current_art(ui);
+  prefetch_next_art(conn, ui);
+}
+
+/**
+ * @brief Picks up every finished conversion from the art worker and caches it
+ * 
+ * @param ui 
+ */
+void receive_album_art(UI* ui)
+{
+  ArtResult *result = art_worker_take(ui->art_worker);
+  while (result)
+  {
+    ArtResult *next = result->next;
+    const ArtRequest *request = &result->request;
+    char *album = art_cache_album(request->uri);
+    bool current = album && ui->art_album && strcmp(album, ui->art_album) == 0 &&
+                   request->width == ui->art_width && request->height == ui->art_height && request->mode == ui->art_mode;
+
+    // a missing cover is cached too so the next track of the album won't ask again,
+    // but not when mpd was unreachable
+    if (album && !result->failed)
+    {
+      if (!result->from_pack) ui->art_transfer = result->transfer;
+      art_cache_insert(&ui->art_cache, album, request->width, request->height, request->mode, result->art);
+      result->art = NULL;
+      if (current)
+      {
+        art_cache_pin(&ui->art_cache, album, request->width, request->height, request->mode);
+      }
+    }
+    else if (current)
+    {
+      ui->art_song_id = -1; // try again on the next player event
+    }
+    else if (result->prefetch)
+    {
+      ui->prefetch_song_id = -1;
+    }
+
+    if (current)
+    {
+      ui->art_loading = false;
+      if (ui->current_tab == home)
+      {
+        ui_mark_dirty(ui, DIRTY_MAIN);
       }
+    }
+    free(album);
+    art_result_free(result);
+    result = next;
+  }
+}
+
+/**
+ * @brief Queues a playback command and shows its expected outcome immediately
+ *        The real state comes back with the next player idle event; without a command worker
+ *        the command runs inline on conn
+ * 
+ * @param conn 
+ * @param ui 
+ * @param op 
+ * @param position queue position for CMD_PLAY_POS, ignored otherwise
+ * @param expected state the footer should show once mpd did it
+ * @param message 
+ */
+static void send_playback(struct mpd_connection *conn, UI* ui, CommandOp op, unsigned position, enum mpd_state expected,
+                          const char *message)
+{
+  if (ui->cmd_worker)
+  {
+    if (!cmd_worker_send(ui->cmd_worker, op, position))
+    {
+      ui_set_message(ui, "Too many commands waiting for mpd");
+      return;
+    }
+    ui->commands_in_flight++;
+  }
+  else
+  {
+    char error[96];
+    if (!command_run(conn, op, position, error, sizeof(error)))
+    {
+      ui->command_failed = true;
+      ui_set_message(ui, "%s failed: %s", message, error);
+      return;
+    }
+  }
+  // time played so far is kept when the state flips under the interpolation
+  set_progress(ui, current_elapsed_ms(ui));
+  ui->play_state = expected;
+  ui_set_message(ui, "%s", message);
+}
+
+/**
+ * @brief Picks up the command worker's results; a rejected playback command rolls the footer back
+ *        to the last state mpd reported, adds report their progress
+ * 
+ * @param ui 
+ */
+void receive_command_results(UI* ui)
+{
+  CommandResult results[COMMAND_QUEUE_SIZE];
+  int count = cmd_worker_take(ui->cmd_worker, results, COMMAND_QUEUE_SIZE);
+  bool rollback = false;
+  for (int i = 0; i < count; i++)
+  {
+    const CommandResult *result = &results[i];
+    if (result->op == CMD_ADD && result->ok)
+    {
+      if (result->final) ui_set_message(ui, "Added %d to the queue", result->total);
+      else ui_set_message(ui, "Adding to the queue... %d/%d", result->done, result->total);
+    }
+    if (!result->final)
+    {
+      continue;
+    }
 
-        // get status to switch play / pause
-        struct mpd_status *status = mpd_recv_status(conn);
-        if (status)
+    if (ui->commands_in_flight > 0) ui->commands_in_flight--;
+    ui->command_failed = !result->ok;
+    if (!result->ok && result->op == CMD_ADD)
+    {
+      ui_set_message(ui, "Added %d of %d: %s", result->done, result->total, result->error);
+    }
+    else if (!result->ok)
+    {
+      ui_set_message(ui, "mpd refused the command: %s", result->error);
+      rollback = true;
+    }
+  }
+  // nothing of ours pending any more, what mpd last told us is the truth again: after a rollback,
+  // or when the player event for our command was handled just before its result came in
+  // (']' on the last song stops mpd, no later event would correct us)
+  if ((rollback || ui->status_deferred) && ui->commands_in_flight == 0 && ui->status)
+  {
+    // a deferred status already set the progress base it goes with
+    if (!ui->status_deferred) set_progress(ui, current_elapsed_ms(ui));
+    ui->play_state = mpd_status_get_state(ui->status);
+    ui->status_deferred = false;
+  }
+  if (count > 0)
+  {
+    ui_mark_dirty(ui, DIRTY_FOOTER);
+  }
+}
+
+/**
+ * @brief Appends uris to the queue in batched command lists, directories recursively
+ *        Takes ownership of uris; runs on the command worker when there is one
+ * 
+ * @param conn 
+ * @param ui 
+ * @param uris 
+ * @param count 
+ */
+static void add_to_queue(struct mpd_connection *conn, UI* ui, char **uris, int count)
+{
+  if (ui->cmd_worker)
+  {
+    if (cmd_worker_send_add(ui->cmd_worker, uris, count))
+    {
+      ui->commands_in_flight++;
+      ui_set_message(ui, "Adding to the queue... 0/%d", count);
+    }
+    else
+    {
+      ui_set_message(ui, "Too many commands waiting for mpd");
+    }
+    return;
+  }
+
+  char error[96];
+  int done = command_run_add(conn, uris, count, error, sizeof(error), NULL, NULL);
+  ui->command_failed = done < count;
+  if (done < count) ui_set_message(ui, "Added %d of %d: %s", done, count, error);
+  else ui_set_message(ui, "Added %d to the queue", count);
+  for (int i = 0; i < count; i++)
+  {
+    free(uris[i]);
+  }
+  free(uris);
+}
+
+/**
+ * @brief Answers the current query, from the library index when it's loaded and from mpd otherwise
+ * 
+ * @param conn 
+ * @param ui 
+ */
+static void run_search(struct mpd_connection *conn, UI* ui)
+{
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  bool ok;
+  if (ui->library.loaded)
+  {
+    ok = search_run_index(&ui->search_index, ui->search_query, &ui->search_results);
+    if (!ok) ui_set_message(ui, "Search failed: out of memory");
+  }
+  else
+  {
+    ok = search_run_server(conn, ui->search_query, &ui->search_results);
+    if (!ok)
+    {
+      ui_set_message(ui, "Search failed: %s", mpd_connection_get_error_message(conn));
+      mpd_connection_clear_error(conn);
+    }
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  ui->search_ms = (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6;
+  ui->search_selected = 0;
+  ui_mark_dirty(ui, DIRTY_MAIN);
+}
+
+/**
+ * @brief Keys while searching: typing refines the query (searched on every key), arrows pick a result
+ * 
+ * @param conn 
+ * @param ui 
+ * @param ch 
+ */
+static void handle_search_key(struct mpd_connection *conn, UI* ui, int ch)
+{
+  int count = ui->search_results.count;
+  switch (ch)
+  {
+    // Esc
+    case 27:
+      ui->show_search = false;
+      ui_mark_dirty(ui, DIRTY_MAIN);
+      break;
+    case KEY_UP:
+      if (ui->search_selected > 0) ui->search_selected--;
+      ui_mark_dirty(ui, DIRTY_MAIN);
+      break;
+    case KEY_DOWN:
+      if (ui->search_selected < count - 1) ui->search_selected++;
+      ui_mark_dirty(ui, DIRTY_MAIN);
+      break;
+    case KEY_PPAGE:
+      ui->search_selected = viewport_page(&ui->search_view, ui->search_selected, -1, count);
+      ui_mark_dirty(ui, DIRTY_MAIN);
+      break;
+    case KEY_NPAGE:
+      ui->search_selected = viewport_page(&ui->search_view, ui->search_selected, 1, count);
+      ui_mark_dirty(ui, DIRTY_MAIN);
+      break;
+    // add the highlighted song
+    case '\n':
+      if (count > 0)
+      {
+        char **uris = malloc(sizeof(char *));
+        if (uris && (uris[0] = strdup(search_result_uri(&ui->search_results, &ui->library, ui->search_selected))))
         {
-          switch (mpd_status_get_state(status))
-          {
-            // switch play -> pause or fail
-            case MPD_STATE_PLAY:
-              if (mpd_run_pause(conn, true))
-              {
-                mvwprintw(ui->main_area, ui->item_count + 2, 2, "Paused");
-              }
-              else
-              {
-                mvwprintw(ui->main_area, ui->item_count + 2, 2, "Failed to pause: %s", 
-                mpd_connection_get_error_message(conn));
-              }
-              break;
-            case MPD_STATE_PAUSE:
-              // switch stop -> play and pause -> play (same action)
-              case MPD_STATE_STOP:
-              if (mpd_run_play(conn))
-              {
-                mvwprintw(ui->main_area, ui->item_count + 2, 2, "Playing");
-              }
-              else
-              {
-                mvwprintw(ui->main_area, ui->item_count + 2, 2, "Failed to play: %s", 
-                mpd_connection_get_error_message(conn));
-              }
-              break;
-                // unknown state
-            default:
-              mvwprintw(ui->main_area, ui->item_count + 2, 2, "Unknown playback state");
-              break;
-          }
-          mpd_status_free(status);
+          add_to_queue(conn, ui, uris, 1);
         }
         else
         {
-          mvwprintw(ui->main_area, ui->item_count + 2, 2, "No status available");
+          free(uris);
         }
-        mpd_response_finish(conn);
-        wrefresh(ui->main_area);            
+      }
+      break;
+    case KEY_BACKSPACE:
+    case 127:
+      if (ui->search_pos > 0)
+      {
+        ui->search_query[--ui->search_pos] = '\0';
+        run_search(conn, ui);
+      }
+      break;
+    default:
+      if (ch >= 32 && ch <= 126 && ui->search_pos < MAX_PATH - 1)
+      {
+        ui->search_query[ui->search_pos++] = ch;
+        ui->search_query[ui->search_pos] = '\0';
+        run_search(conn, ui);
+      }
+      break;
+  }
+}
+
+/**
+ * @brief Hands the current pattern to the fuzzy finder, matches stream back through receive_jump_results
+ * 
+ * @param ui 
+ */
+static void run_jump(UI* ui)
+{
+  ui->jump_count = 0;
+  ui->jump_scanned = 0;
+  ui->jump_selected = 0;
+  if (ui->fuzzy)
+  {
+    fuzzy_finder_query(ui->fuzzy, ui->jump_query);
+  }
+  ui_mark_dirty(ui, DIRTY_MAIN);
+}
+
+void receive_jump_results(UI* ui)
+{
+  ui->jump_count = fuzzy_finder_results(ui->fuzzy, ui->jump_results, FUZZY_MAX_RESULTS, &ui->jump_scanned);
+  if (ui->jump_selected >= ui->jump_count)
+  {
+    ui->jump_selected = ui->jump_count > 0 ? ui->jump_count - 1 : 0;
+  }
+  if (ui->show_jump)
+  {
+    ui_mark_dirty(ui, DIRTY_MAIN);
+  }
+}
+
+/**
+ * @brief Opens the highlighted match in the browser, a song as its folder with the song highlighted
+ * 
+ * @param conn 
+ * @param ui 
+ */
+static void jump_to_result(struct mpd_connection *conn, UI* ui)
+{
+  bool is_dir;
+  const char *path = fuzzy_candidate(ui->fuzzy, ui->jump_results[ui->jump_selected].candidate, &is_dir);
+  char *target = is_dir ? strdup(path) : get_parent_directory(path);
+  if (!target)
+  {
+    return;
+  }
+  free(ui->current_directory);
+  ui->current_directory = target;
+  ui->selected_index = 0;
+  ui->listing = NULL;
+  if (!is_dir)
+  {
+    const DirListing *listing = dir_cache_get(&ui->dir_cache, conn, target);
+    if (!listing)
+    {
+      // the browser asks again and shows the error
+      mpd_connection_clear_error(conn);
+    }
+    for (int i = 0; listing && i < listing->count; i++)
+    {
+      if (strcmp(listing->uris[i], path) == 0)
+      {
+        ui->selected_index = i;
+        break;
+      }
+    }
+  }
+  ui->show_jump = false;
+  ui_mark_dirty(ui, DIRTY_MAIN);
+}
+
+/**
+ * @brief Keys in the jump overlay: typing refines the pattern (the old scan is dropped), arrows pick a match
+ * 
+ * @param conn 
+ * @param ui 
+ * @param ch 
+ */
+static void handle_jump_key(struct mpd_connection *conn, UI* ui, int ch)
+{
+  int count = ui->jump_count;
+  switch (ch)
+  {
+    // Esc, an empty pattern also stops the scan
+    case 27:
+      ui->show_jump = false;
+      ui->jump_query[0] = '\0';
+      ui->jump_pos = 0;
+      run_jump(ui);
+      break;
+    case KEY_UP:
+      if (ui->jump_selected > 0) ui->jump_selected--;
+      ui_mark_dirty(ui, DIRTY_MAIN);
+      break;
+    case KEY_DOWN:
+      if (ui->jump_selected < count - 1) ui->jump_selected++;
+      ui_mark_dirty(ui, DIRTY_MAIN);
+      break;
+    case KEY_PPAGE:
+      ui->jump_selected = viewport_page(&ui->jump_view, ui->jump_selected, -1, count);
+      ui_mark_dirty(ui, DIRTY_MAIN);
+      break;
+    case KEY_NPAGE:
+      ui->jump_selected = viewport_page(&ui->jump_view, ui->jump_selected, 1, count);
+      ui_mark_dirty(ui, DIRTY_MAIN);
+      break;
+    case '\n':
+      if (count > 0)
+      {
+        jump_to_result(conn, ui);
+      }
+      break;
+    case KEY_BACKSPACE:
+    case 127:
+      if (ui->jump_pos > 0)
+      {
+        ui->jump_query[--ui->jump_pos] = '\0';
+        run_jump(ui);
+      }
+      break;
+    default:
+      if (ch >= 32 && ch <= 126 && ui->jump_pos < FUZZY_QUERY_MAX - 1)
+      {
+        ui->jump_query[ui->jump_pos++] = ch;
+        ui->jump_query[ui->jump_pos] = '\0';
+        run_jump(ui);
+      }
+      break;
+  }
+}
+
+/**
+ * @brief Handles a single key press, switching tabs and sending playback commands
+ * 
+ * @param conn 
+ * @param ui 
+ * @param current_win 
+ * @param ch 
+ */
+static void handle_key(struct mpd_connection *conn, UI* ui, int *current_win, int ch)
+{
+  const DirListing *listing = ui->listing;
+  int item_count = listing ? listing->count : 0;
+
+  // while searching every key belongs to the query
+  if (ui->show_search)
+  {
+    handle_search_key(conn, ui, ch);
+    return;
+  }
+  if (ui->show_jump)
+  {
+    handle_jump_key(conn, ui, ch);
+    return;
+  }
+  if (ch == '/' && !ui->show_directory_selection)
+  {
+    ui->show_search = true;
+    ui_mark_dirty(ui, DIRTY_MAIN);
+    return;
+  }
+  if (ch == 'j' && ui->show_directory_browser)
+  {
+    ui->show_jump = true;
+    run_jump(ui);
+    return;
+  }
+
+  // looping window tabs
+  if (ch == KEY_LEFT)
+  {
+    if (*current_win == 0)
+    {
+      *current_win = 3;
+    }
+    else 
+    {
+      *current_win -= 1;
+    }
+  }
+  if (ch == KEY_RIGHT)
+  {
+    if (*current_win == 3)
+    {
+      *current_win = 0;
+    }
+    else
+    {
+      *current_win += 1;
     }
+  }
 
-    // skip to next song
-    else if (ch == ']') 
+  // playback keys only queue the command, the footer shows the outcome right away
+  if (ch == 'p')
+  {
+    if (ui->play_state == MPD_STATE_PLAY)
     {
-      if (!mpd_run_next(conn))
-      {
-        mvwprintw(ui->main_area, 10, 10, "Error skipping song: %s", mpd_connection_get_error_message(conn));
-      }
+      send_playback(conn, ui, CMD_PAUSE, 0, MPD_STATE_PAUSE, "Paused");
     }
-    else if (ch == '[')
+    else
     {
-      if (!mpd_run_previous(conn))
-      {
-        mvwprintw(ui->main_area, 10, 10, "Error running prev song: %s", mpd_connection_get_error_message(conn));
-      }
-
+      // switch stop -> play and pause -> play (same action)
+      send_playback(conn, ui, CMD_PLAY, 0, MPD_STATE_PLAY, "Playing");
     }
+  }
+
+  // skip to next song
+  else if (ch == ']') 
+  {
+    send_playback(conn, ui, CMD_NEXT, 0, ui->play_state, "Next song");
+  }
+  else if (ch == '[')
+  {
+    send_playback(conn, ui, CMD_PREVIOUS, 0, ui->play_state, "Previous song");
+  }
 
-    // once we enter in the directory browser we can search for music in the user defined dir
-    else if (ui->show_directory_browser) 
+  // once we enter in the directory browser we can search for music in the user defined dir
+  else if (ui->show_directory_browser) 
+  {
+    // explore directory
+    switch (ch) 
     {
-      // explore directory
-      switch (ch) 
-      {
-        // scroll up and down 
-        case KEY_UP:
-          if (ui->selected_index > 0) ui->selected_index--;
-          break;
-        case KEY_DOWN:
-          if (ui->selected_index < ui->item_count - 1) ui->selected_index++;
-          break;
+      // scroll up and down 
+      case KEY_UP:
+        if (ui->selected_index > 0) ui->selected_index--;
+        ui_mark_dirty(ui, DIRTY_SELECTION);
+        break;
+      case KEY_DOWN:
+        if (ui->selected_index < item_count - 1) ui->selected_index++;
+        ui_mark_dirty(ui, DIRTY_SELECTION);
+        break;
+      case KEY_PPAGE:
+        ui->selected_index = viewport_page(&ui->dir_view, ui->selected_index, -1, item_count);
+        ui_mark_dirty(ui, DIRTY_SELECTION);
+        break;
+      case KEY_NPAGE:
+        ui->selected_index = viewport_page(&ui->dir_view, ui->selected_index, 1, item_count);
+        ui_mark_dirty(ui, DIRTY_SELECTION);
+        break;
+      case KEY_HOME:
+        ui->selected_index = 0;
+        ui_mark_dirty(ui, DIRTY_SELECTION);
+        break;
+      case KEY_END:
+        ui->selected_index = item_count > 0 ? item_count - 1 : 0;
+        ui_mark_dirty(ui, DIRTY_SELECTION);
+        break;
 
-        // select a directory or add song to queue
-        case '\n':
-          if (ui->item_count == 0 || ui->selected_index < 0 || ui->selected_index >= ui->item_count)
+      // select a directory or add song to queue
+      case '\n':
+        if (item_count == 0 || ui->selected_index < 0 || ui->selected_index >= item_count)
+        {
+          break; // No valid selection
+        }
+        // go down directory
+        if (listing->types[ui->selected_index] == ENTRY_DIRECTORY) 
+        {
+          const char *new_dir = listing->uris[ui->selected_index];
+          free(ui->current_directory);
+          ui->current_directory = strdup(new_dir);
+          ui->selected_index = 0;
+          ui_mark_dirty(ui, DIRTY_MAIN);
+        }
+        // add song to queue and play, one round trip
+        else 
+        {
+          if (mpd_command_list_begin(conn, false) &&
+              mpd_send_add(conn, listing->uris[ui->selected_index]) &&
+              mpd_send_play(conn) &&
+              mpd_command_list_end(conn) &&
+              mpd_response_finish(conn))
           {
-            break; // No valid selection
+            ui_set_message(ui, "Song added");
           }
-          // go down directory
-          if (ui->item_types[ui->selected_index] == 0) 
+          else
           {
-            char *new_dir = ui->item_uris[ui->selected_index];
-            free(ui->current_directory);
-            ui->current_directory = strdup(new_dir);
-            ui->selected_index = 0;
+            ui_set_message(ui, "Failed to add song: %s", mpd_connection_get_error_message(conn));
+            mpd_connection_clear_error(conn);
           }
-          // add song to queue
-          else 
+        }
+        break;
+
+      // mark or unmark the entry and move on to the next
+      case ' ':
+        if (item_count == 0) break;
+        selection_toggle(&ui->marked, listing->uris[ui->selected_index]);
+        if (ui->selected_index < item_count - 1) ui->selected_index++;
+        ui_mark_dirty(ui, DIRTY_MAIN);
+        break;
+
+      // mark everything in this directory
+      case '*':
+        for (int i = 0; i < item_count; i++)
+        {
+          selection_add(&ui->marked, listing->uris[i]);
+        }
+        ui_mark_dirty(ui, DIRTY_MAIN);
+        break;
+
+      // forget the marks
+      case 'c':
+        selection_clear(&ui->marked);
+        ui_mark_dirty(ui, DIRTY_MAIN);
+        break;
+
+      // add the marked entries, or the highlighted one, directories with everything below them
+      case 'a':
+        if (ui->marked.count > 0)
+        {
+          int count;
+          char **uris = selection_take(&ui->marked, &count);
+          add_to_queue(conn, ui, uris, count);
+          ui_mark_dirty(ui, DIRTY_MAIN);
+        }
+        else if (item_count > 0)
+        {
+          char **uris = malloc(sizeof(char *));
+          if (uris && (uris[0] = strdup(listing->uris[ui->selected_index])))
           {
-            if (mpd_run_add(conn, ui->item_uris[ui->selected_index]))
-            {
-              mvwprintw(ui->main_area, ui->item_count + 2, 2, "Song added");
-              if (!mpd_run_play(conn))
-              {
-                mvwprintw(ui->main_area, ui->item_count + 3, 2, "Failed to play: %s", 
-                mpd_connection_get_error_message(conn));
-              }
-            }
-            else
-            {
-              mvwprintw(ui->main_area, ui->item_count + 2, 2, "Failed to add song: %s", 
-              mpd_connection_get_error_message(conn));
-            }
-            wrefresh(ui->main_area);
-            mpd_response_finish(conn);    
+            add_to_queue(conn, ui, uris, 1);
           }
-          break;
-            // go up a dir
-        case 'u':
-          char *parent = get_parent_directory(ui->current_directory);
-          if (parent) 
+          else
           {
-            free(ui->current_directory);
-            ui->current_directory = parent;
-            ui->selected_index = 0;
+            free(uris);
           }
-          break;
-      }
-    }
-    else if (ui->show_directory_selection) 
-    {
-      if (ch == '\n') 
-      {
-        free(ui->current_directory);
-        ui->current_directory = strdup(ui->input_buffer);
-        ui->show_directory_selection = false;
-      }
-      else if (ch == 27) 
-      {   
-        // Esc
-        strncpy(ui->input_buffer, ui->current_directory, MAX_PATH - 1);
-        ui->input_buffer[MAX_PATH - 1] = '\0';
-        ui->input_pos = strlen(ui->input_buffer);
-        ui->show_directory_selection = false;
-      }
-      else if (ch == KEY_BACKSPACE || ch == 127) 
-      {
-        if (ui->input_pos > 0) 
+        }
+        break;
+          // go up a dir
+      case 'u':
+        char *parent = get_parent_directory(ui->current_directory);
+        if (parent) 
         {
-          ui->input_buffer[--ui->input_pos] = '\0';
+          free(ui->current_directory);
+          ui->current_directory = parent;
+          ui->selected_index = 0;
+          ui_mark_dirty(ui, DIRTY_MAIN);
         }
-      } 
-      else if (ch >= 32 && ch <= 126 && ui->input_pos < MAX_PATH - 1) 
-      {
-        ui->input_buffer[ui->input_pos++] = ch;
-        ui->input_buffer[ui->input_pos] = '\0';
-      }
+        break;
+      default:
+        // shift + letter jumps to the first entry starting with it
+        if (ch >= 'A' && ch <= 'Z' && listing && !listing->streaming)
+        {
+          int found = dir_listing_find_letter(listing, ch);
+          if (found >= 0) ui->selected_index = found;
+          ui_mark_dirty(ui, DIRTY_SELECTION);
+        }
+        break;
     }
-
-    // update current window
-    switch (current_win) 
+  }
+  // the queue tab scrolls like the browser, rows load as they come into view
+  else if (ui->current_tab == queue)
+  {
+    int queue_length = ui->queue.length;
+    switch (ch)
     {
-      // home 
-      case 0:
-        ui->show_directory_browser = false;
-        // ui->show_playlists = false
-        ui->show_help = false;
+      case KEY_UP:
+        if (ui->queue_selected > 0) ui->queue_selected--;
+        ui_mark_dirty(ui, DIRTY_MAIN);
         break;
-      // directory
-      case 1:
-        ui->show_directory_browser = true;
-        ui->show_help = false;
-        // ui->show_playlists = false 
+      case KEY_DOWN:
+        if (ui->queue_selected < queue_length - 1) ui->queue_selected++;
+        ui_mark_dirty(ui, DIRTY_MAIN);
         break;
-      // playlist
-      case 2:
-        ui->show_directory_browser = false;
-        // ui->show_playlists = true
-        ui->show_help = false;
+      case KEY_PPAGE:
+        ui->queue_selected = viewport_page(&ui->queue_view, ui->queue_selected, -1, queue_length);
+        ui_mark_dirty(ui, DIRTY_MAIN);
         break;
-      // help
-      case 3:
-        ui->show_directory_browser = false;
-        ui->show_help = true;
-        // ui->show_playlists = false
+      case KEY_NPAGE:
+        ui->queue_selected = viewport_page(&ui->queue_view, ui->queue_selected, 1, queue_length);
+        ui_mark_dirty(ui, DIRTY_MAIN);
+        break;
+      case KEY_HOME:
+        ui->queue_selected = 0;
+        ui_mark_dirty(ui, DIRTY_MAIN);
+        break;
+      case KEY_END:
+        ui->queue_selected = queue_length > 0 ? queue_length - 1 : 0;
+        ui_mark_dirty(ui, DIRTY_MAIN);
+        break;
+      // play the highlighted position, queued like the other playback keys
+      case '\n':
+        if (queue_length == 0) break;
+        send_playback(conn, ui, CMD_PLAY_POS, ui->queue_selected, MPD_STATE_PLAY, "Playing");
         break;
       default:
         break;
     }
-    ui->current_tab = current_win;
+  }
+  else if (ui->show_directory_selection) 
+  {
+    if (ch == '\n') 
+    {
+      free(ui->current_directory);
+      ui->current_directory = strdup(ui->input_buffer);
+      ui->show_directory_selection = false;
+      ui_mark_dirty(ui, DIRTY_MAIN);
+    }
+    else if (ch == 27) 
+    {   
+      // Esc
+      strncpy(ui->input_buffer, ui->current_directory, MAX_PATH - 1);
+      ui->input_buffer[MAX_PATH - 1] = '\0';
+      ui->input_pos = strlen(ui->input_buffer);
+      ui->show_directory_selection = false;
+      ui_mark_dirty(ui, DIRTY_MAIN);
+    }
+    else if (ch == KEY_BACKSPACE || ch == 127) 
+    {
+      if (ui->input_pos > 0) 
+      {
+        ui->input_buffer[--ui->input_pos] = '\0';
+      }
+    } 
+    else if (ch >= 32 && ch <= 126 && ui->input_pos < MAX_PATH - 1) 
+    {
+      ui->input_buffer[ui->input_pos++] = ch;
+      ui->input_buffer[ui->input_pos] = '\0';
+    }
+    ui_mark_dirty(ui, DIRTY_INPUT);
+  }
 
-    update_header(ui);
-    update_main_area(conn, ui);
-    update_footer(conn, ui);
+  // update current window
+  switch (*current_win) 
+  {
+    // home 
+    case 0:
+      ui->show_directory_browser = false;
+      // ui->show_playlists = false
+      ui->show_help = false;
+      break;
+    // directory
+    case 1:
+      ui->show_directory_browser = true;
+      ui->show_help = false;
+      // ui->show_playlists = false 
+      break;
+    // playlist
+    case 2:
+      ui->show_directory_browser = false;
+      // ui->show_playlists = true
+      ui->show_help = false;
+      break;
+    // help
+    case 3:
+      ui->show_directory_browser = false;
+      ui->show_help = true;
+      // ui->show_playlists = false
+      break;
+    default:
+      break;
+  }
+  if (ui->current_tab != (Tab)*current_win)
+  {
+    ui->current_tab = *current_win;
+    ui_mark_dirty(ui, DIRTY_TABS | DIRTY_MAIN);
   }
 }
 
 /**
- * @brief Get the parent directory object
+ * @brief Reloads the library index after the database changed
+ *        With the worker the current index (or mpd) keeps serving the browser until the new one lands,
+ *        without it browsing falls back to asking mpd per directory if the load fails
  * 
- * @param path 
- * @return char* 
+ * @param conn 
+ * @param ui 
  */
-char *get_parent_directory(const char *path)
+static void reload_library(struct mpd_connection *conn, UI* ui)
 {
-  if (strlen(path) == 0)
+  ui->listing = NULL;
+  // the snapshot from the last run is still current, nothing to load
+  if (ui->library.loaded && ui->library.db_update == ui->dir_cache.db_update)
   {
-    return NULL;
+    return;
   }
-
-  char *last_slash = strrchr(path, '/');
-
-  if (last_slash == NULL)
+  if (ui->library_worker)
   {
-    return strdup("");
+    library_worker_request(ui->library_worker, ui->dir_cache.db_update);
+    return;
+  }
+  search_index_free(&ui->search_index);
+  search_results_clear(&ui->search_results);
+  if (ui->fuzzy)
+  {
+    fuzzy_finder_reset(ui->fuzzy);
+  }
+  if (library_load(&ui->library, conn, ui->dir_cache.db_update))
+  {
+    ui_set_message(ui, "Library: %u songs in %u folders", ui->library.song_count, ui->library.dir_count);
+  }
+  else
+  {
+    // a stale index would show folders that are gone
+    library_free(&ui->library);
+    mpd_connection_clear_error(conn);
+  }
+  if (ui->show_jump)
+  {
+    run_jump(ui);
   }
-
-  size_t len = last_slash - path;
-  char *parent = malloc(len + 1);
-  strncpy(parent, path, len);
-  parent[len] = '\0';
-
-  return parent;
 }
 
 /**
- * @brief Fetches album art for the current song and saves it to a temporary file
- * @param conn MPD connection
- * @param temp_file Path to save the temporary JPEG file
- * @return 0 on success, -1 on failure
+ * @brief Swaps in the index the library worker finished, listings are rebuilt from it
+ * 
+ * @param ui 
  */
-int fetch_album_art(struct mpd_connection *conn, const char *temp_file) 
+static void receive_library(UI* ui)
 {
-  // Clear any prior errors
-  mpd_connection_clear_error(conn);
-
-  // Get current song
-  if (!mpd_send_current_song(conn)) 
+  // the finder's threads read the library, they let go of it before the swap
+  if (ui->fuzzy)
   {
-    fprintf(stderr, "Failed to send current song command: %s\n", 
-            mpd_connection_get_error_message(conn));
-    mpd_response_finish(conn);
-    return -1;
+    fuzzy_finder_reset(ui->fuzzy);
   }
-
-  struct mpd_song *song = mpd_recv_song(conn);
-  if (!song) 
+  bool taken = library_worker_take(ui->library_worker, &ui->library);
+  // matches of the old library are gone either way
+  if (ui->show_jump)
   {
-    fprintf(stderr, "No current song or error retrieving it: %s\n",
-            mpd_connection_get_error_message(conn));
-    mpd_response_finish(conn);
-    return -1;
+    run_jump(ui);
+  }
+  if (!taken)
+  {
+    return;
+  }
+  dir_cache_clear(&ui->dir_cache);
+  ui->listing = NULL;
+  // results point into the old index
+  search_index_free(&ui->search_index);
+  search_results_clear(&ui->search_results);
+  ui_set_message(ui, "Library: %u songs in %u folders", ui->library.song_count, ui->library.dir_count);
+  if (ui->current_tab == directory || ui->show_search || ui->show_jump)
+  {
+    ui_mark_dirty(ui, DIRTY_MAIN);
   }
+}
 
-  const char *song_uri = mpd_song_get_uri(song);
-  if (!song_uri) 
+/**
+ * @brief Takes the newest spectrum frame, the footer is repainted at most SPECTRUM_FPS times a second
+ *        so a slow terminal isn't flooded, frames that arrive in between only replace the one we hold
+ * 
+ * @param ui 
+ */
+void receive_spectrum(UI* ui)
+{
+  if (!spectrum_take(ui->spectrum, &ui->spectrum_frame) || ui->play_state != MPD_STATE_PLAY)
   {
-    fprintf(stderr, "No URI for current song\n");
-    mpd_song_free(song);
-    mpd_response_finish(conn);
-    return -1;
+    return;
+  }
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  long elapsed = (now.tv_sec - ui->spectrum_drawn.tv_sec) * 1000000000L + (now.tv_nsec - ui->spectrum_drawn.tv_nsec);
+  // a little slack so frames arriving a hair early aren't skipped every other time
+  if (elapsed >= SPECTRUM_REDRAW_NS * 3 / 4)
+  {
+    ui->spectrum_drawn = now;
+    ui_mark_dirty(ui, DIRTY_FOOTER);
   }
+}
 
-  char *song_uri_copy = strdup(song_uri);  // Copy to avoid const issues
-  mpd_song_free(song);
-  mpd_response_finish(conn);
+/**
+ * @brief Appends what the listing worker streamed to the open folder
+ *        The finished listing gets sorted, the highlight follows the entry it was on
+ * 
+ * @param ui 
+ */
+static void receive_listing(UI* ui)
+{
+  const DirListing *listing = ui->listing;
+  bool was_streaming = listing && listing->streaming;
+  // arena strings don't move when the listing is sorted
+  const char *selected = was_streaming && ui->selected_index < listing->count ? listing->uris[ui->selected_index] : NULL;
 
-  // Send readpicture command for the song
-  if (!mpd_send_readpicture(conn, song_uri_copy, 0)) 
+  ListingState state = dir_cache_receive(&ui->dir_cache);
+  if (state == LISTING_FAILED)
   {
-    fprintf(stderr, "Failed to send readpicture command: %s\n", 
-            mpd_connection_get_error_message(conn));
-    free(song_uri_copy);
-    mpd_response_finish(conn);
-    return -1;
+    ui->listing = NULL;
+    ui_set_message(ui, "Listing failed: %s", ui->dir_cache.error);
   }
-
-  // Open temporary file for writing
-  FILE *fp = fopen(temp_file, "wb");
-  if (!fp) 
+  else if (was_streaming && !listing->streaming && selected)
   {
-    fprintf(stderr, "Failed to open temporary file %s: %s\n", temp_file, strerror(errno));
-    free(song_uri_copy);
-    mpd_response_finish(conn);
-    return -1;
+    for (int i = 0; i < listing->count; i++)
+    {
+      if (listing->uris[i] == selected)
+      {
+        ui->selected_index = i;
+        break;
+      }
+    }
   }
+  if (ui->show_directory_browser)
+  {
+    ui_mark_dirty(ui, DIRTY_MAIN);
+  }
+}
 
-  // Allocate buffer for reading picture data
-  const size_t buffer_size = 8192;  // Default chunk size as per documentation
-  char *buffer = malloc(buffer_size);
-  if (!buffer) 
+/**
+ * @brief Brings the ui back in line with mpd after (re)connecting, we don't know what changed meanwhile
+ * 
+ * @param conn 
+ * @param ui 
+ */
+static void resync(struct mpd_connection *conn, UI* ui)
+{
+  refresh_player_state(conn, ui);
+  queue_list_reset(&ui->queue);
+  ui->art_song_id = -1;
+  ui->prefetch_song_id = -1;
+  request_album_art(conn, ui);
+  if (dir_cache_sync_db_update(&ui->dir_cache, conn))
   {
-    fprintf(stderr, "Failed to allocate buffer for binary data\n");
-    fclose(fp);
-    unlink(temp_file);
-    free(song_uri_copy);
-    mpd_response_finish(conn);
-    return -1;
+    reload_library(conn, ui);
   }
+  ui_mark_dirty(ui, DIRTY_ALL);
+}
+
+/**
+ * @brief Main tui loop that gets user input, default is main screen but user can switch screens
+ *        This is what is called by main
+ *        The loop sleeps in poll() on the idle connection, stdin and a 1s clock timer,
+ *        so nothing is sent to mpd unless a key was pressed or mpd reported a change.
+ *        Commands go over the link's other connection, and a dropped link is retried with backoff
+ *        while the ui keeps running
+ * @param link 
+ * @param ui 
+ */
+void run_tui(MpdLink *link, UI* ui) 
+{
+  int current_win = 0; 
+  int ch;
+  bool running = true;
 
-  // Read picture data in chunks
-  size_t total_bytes_written = 0;
-  int bytes_read;
-  while ((bytes_read = mpd_recv_readpicture(conn, buffer, buffer_size)) > 0) 
+  // ticks once a second for the header clock and footer animation
+  int timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  struct itimerspec tick = { .it_interval = { 1, 0 }, .it_value = { 1, 0 } };
+  timerfd_settime(timer_fd, 0, &tick, NULL);
+  // one shot, armed for whenever the progress line next changes while playing
+  int progress_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+
+  // we only read keys once poll() says stdin has something
+  nodelay(stdscr, TRUE);
+  // getch() refreshes stdscr, get its first full repaint out of the way before we draw
+  refresh();
+
+  ui->offline = !link->connected;
+  resync(link->cmd, ui);
+  ui_render(link->cmd, ui);
+  arm_progress_timer(ui, progress_fd);
+
+  while (running) 
   {
-    size_t written = fwrite(buffer, 1, bytes_read, fp);
-    if (written != (size_t)bytes_read) 
+    // mpd holds the idle connection until one of our events fires
+    int idle_fd = mpd_link_idle_fd(link);
+
+    struct pollfd fds[10] = {
+      { .fd = STDIN_FILENO, .events = POLLIN },
+      { .fd = idle_fd, .events = POLLIN },
+      { .fd = timer_fd, .events = POLLIN },
+      { .fd = ui->art_worker ? ui->art_worker->event_fd : -1, .events = POLLIN },
+      { .fd = ui->cmd_worker ? ui->cmd_worker->event_fd : -1, .events = POLLIN },
+      { .fd = ui->library_worker ? ui->library_worker->event_fd : -1, .events = POLLIN },
+      { .fd = ui->fuzzy ? ui->fuzzy->event_fd : -1, .events = POLLIN },
+      { .fd = ui->dir_cache.worker ? ui->dir_cache.worker->event_fd : -1, .events = POLLIN },
+      { .fd = ui->spectrum ? ui->spectrum->event_fd : -1, .events = POLLIN },
+      { .fd = progress_fd, .events = POLLIN },
+    };
+    // while offline we also wake up when the next reconnect attempt is due
+    if (poll(fds, 10, mpd_link_retry_timeout(link)) < 0 && errno != EINTR)
+    {
+      break;
+    }
+
+    enum mpd_idle events = 0;
+    if (fds[1].revents & (POLLIN | POLLHUP | POLLERR))
+    {
+      events = mpd_link_idle_events(link);
+    }
+    if (mpd_link_retry(link))
+    {
+      ui->offline = false;
+      ui_set_message(ui, "Reconnected to mpd");
+      resync(link->cmd, ui);
+    }
+    struct mpd_connection *conn = link->cmd;
+
+    if (fds[2].revents & POLLIN)
+    {
+      uint64_t expirations;
+      if (read(timer_fd, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN)
+      {
+        break;
+      }
+      // cmd never idles, mpd would close it after a quiet minute
+      mpd_link_keepalive(link);
+      // the footer animation only moves while playing
+      ui_mark_dirty(ui, DIRTY_CLOCK);
+      if (ui->status && mpd_status_get_state(ui->status) == MPD_STATE_PLAY)
+      {
+        ui_mark_dirty(ui, DIRTY_FOOTER);
+      }
+    }
+
+    if (events & (MPD_IDLE_PLAYER | MPD_IDLE_QUEUE | MPD_IDLE_MIXER | MPD_IDLE_OPTIONS))
+    {
+      refresh_player_state(conn, ui);
+      request_album_art(conn, ui);
+      ui_mark_dirty(ui, DIRTY_FOOTER);
+      // the queue tab syncs itself when drawn, it only needs to know something moved
+      if (ui->current_tab == home || ui->current_tab == queue)
+      {
+        ui_mark_dirty(ui, DIRTY_MAIN);
+      }
+    }
+    if (fds[3].revents & POLLIN)
+    {
+      receive_album_art(ui);
+    }
+    if (fds[4].revents & POLLIN)
+    {
+      receive_command_results(ui);
+    }
+    if (fds[5].revents & POLLIN)
+    {
+      receive_library(ui);
+    }
+    if (fds[6].revents & POLLIN)
+    {
+      receive_jump_results(ui);
+    }
+    if (fds[7].revents & POLLIN)
+    {
+      receive_listing(ui);
+    }
+    if (fds[8].revents & POLLIN)
+    {
+      receive_spectrum(ui);
+    }
+    if (fds[9].revents & POLLIN)
+    {
+      uint64_t expirations;
+      if (read(progress_fd, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN)
+      {
+        break;
+      }
+      ui_mark_dirty(ui, DIRTY_FOOTER);
+    }
+    // listings and the library index are only rebuilt when the database actually changed
+    if ((events & MPD_IDLE_DATABASE) && dir_cache_sync_db_update(&ui->dir_cache, conn))
+    {
+      reload_library(conn, ui);
+      if (ui->current_tab == directory)
+      {
+        ui_mark_dirty(ui, DIRTY_MAIN);
+      }
+    }
+
+    while ((ch = getch()) != ERR) 
+    {
+      if (ch == 'q' && !ui->show_search && !ui->show_jump)
+      {
+        running = false;
+        break;
+      }
+      handle_key(conn, ui, &current_win, ch);
+    }
+    if (!running)
+    {
+      break;
+    }
+
+    // a dead link shows up as a failed command or a hangup on the idle connection
+    if (!mpd_link_check(link) && !ui->offline)
+    {
+      ui->offline = true;
+      ui_mark_dirty(ui, DIRTY_FOOTER);
+    }
+    else if (link->cmd_reopened)
     {
-      fprintf(stderr, "Failed to write to temp file: %s\n", strerror(errno));
-      free(buffer);
-      fclose(fp);
-      unlink(temp_file);
-      free(song_uri_copy);
-      mpd_response_finish(conn);
-      return -1;
+      // mpd had closed cmd, whatever we asked on it this round came back empty
+      link->cmd_reopened = false;
+      conn = link->cmd;
+      resync(conn, ui);
     }
-    total_bytes_written += written;
+    ui_render(conn, ui);
+    arm_progress_timer(ui, progress_fd);
   }
 
-  free(buffer);
-  fclose(fp);
-  mpd_response_finish(conn);
+  close(progress_fd);
+  close(timer_fd);
+}
 
-  // Check if we read any data
-  if (total_bytes_written == 0) 
+/**
+ * @brief Get the parent directory object
+ * 
+ * @param path 
+ * @return char* 
+ */
+char *get_parent_directory(const char *path)
+{
+  if (strlen(path) == 0)
   {
-    fprintf(stderr, "No picture data available for %s\n", song_uri_copy);
-    free(song_uri_copy);
-    unlink(temp_file);
-    return -1;
+    return NULL;
   }
 
-  free(song_uri_copy);
+  char *last_slash = strrchr(path, '/');
 
-  // Final error check
-  if (bytes_read < 0 || mpd_connection_get_error(conn) != MPD_ERROR_SUCCESS) 
+  if (last_slash == NULL)
   {
-    fprintf(stderr, "MPD error after fetching picture: %s\n", 
-            mpd_connection_get_error_message(conn));
-    unlink(temp_file);
-    return -1;
+    return strdup("");
   }
 
-  return 0;
-}
\ No newline at end of file
+  size_t len = last_slash - path;
+  char *parent = malloc(len + 1);
+  strncpy(parent, path, len);
+  parent[len] = '\0';
+
+  return parent;
+}
@@ -0,0 +1,37 @@
+#include "../include/viewport.h"
+
+void viewport_follow(Viewport *view, int selected, int count)
+{
+    if (view->rows <= 0)
+    {
+        view->offset = 0;
+        return;
+    }
+    if (selected < view->offset)
+    {
+        view->offset = selected;
+    }
+    else if (selected >= view->offset + view->rows)
+    {
+        view->offset = selected - view->rows + 1;
+    }
+
+    // don't leave empty rows at the bottom when the list got shorter
+    if (view->offset > count - view->rows) view->offset = count - view->rows;
+    if (view->offset < 0) view->offset = 0;
+}
+
+int viewport_page(const Viewport *view, int selected, int pages, int count)
+{
+    int step = view->rows > 1 ? view->rows - 1 : 1; // keep one row of context
+    selected += pages * step;
+    if (selected >= count) selected = count - 1;
+    if (selected < 0) selected = 0;
+    return selected;
+}
+
+int viewport_end(const Viewport *view, int count)
+{
+    int end = view->offset + view->rows;
+    return end < count ? end : count;
+}